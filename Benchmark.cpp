@@ -0,0 +1,152 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * Authored By Gordon Williams <gw@pur3.co.uk>
+ *
+ * Copyright (C) 2009 Pur3 Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * This is a program to time parts of TinyJS on large inputs. Build it with
+ * optimisation for meaningful numbers, eg: make clean; make CFLAGS="-c -O2" Benchmark
+ */
+
+#include "TinyJS.h"
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/// Some typical source, repeated to make a large input
+static const char *benchmarkSource =
+  "// work out the total of some items, with the rate applied\n"
+  "function computeTotal(items, rate) {\n"
+  "  var total = 0; /* running total */\n"
+  "  for (var i=0;i<items.length;i++) {\n"
+  "    if (items[i].price >= 100 && items[i].discounted != true) total += items[i].price * 0.95;\n"
+  "    else total = total + items[i].price * rate + 0x1F - 017;\n"
+  "  }\n"
+  "  return { name : \"total\", value : total, note : 'it\\'s done', scale : 1.5e3 };\n"
+  "}\n"
+  "var settings = { width : 640, height : 480, title : \"A window with quite a long title\" };\n"
+  "\n";
+
+/// Configuration-like source, mostly comments, indentation and long strings
+static const char *configSource =
+  "/* ------------------------------------------------------------------------\n"
+  " * Settings for one of the services. Each entry below is read at startup, and\n"
+  " * anything that is left out keeps the default value given in the manual.\n"
+  " * ------------------------------------------------------------------------ */\n"
+  "var service = {\n"
+  "        name        : \"a service with a fairly long and descriptive name\",\n"
+  "        description : \"Handles the requests that come in from the front end, and passes them on to the workers\",\n"
+  "        // where to find things, and where to write the logs\n"
+  "        paths       : [ \"/usr/local/share/service/templates\", \"/var/log/service/requests.log\" ],\n"
+  "        banner      : 'Welcome! This service is \\'read only\\' during maintenance windows',\n"
+  "        retries     : 3\n"
+  "};\n"
+  "\n";
+
+static double seconds(clock_t start) {
+  return (double)(clock()-start) / CLOCKS_PER_SEC;
+}
+
+/// Split the source into tokens (all done when the Lexer is made) a few times over
+static void benchmarkLexer(const char *name, const std::string &source, int repeats) {
+  int tokens = 0;
+  clock_t start = clock();
+  for (int r=0;r<repeats;r++) {
+    TinyJS::Lexer lexer(source);
+    tokens = 0;
+    while (lexer.tk != TinyJS::LEXER_EOF) {
+      tokens++;
+      lexer.match(lexer.tk);
+    }
+  }
+  double t = seconds(start);
+  double mb = (double)source.size()*repeats / (1024*1024);
+  printf("lexer %-7s %7.1f MB/s  (%d tokens in %.1f MB, %.3fs)\n",
+         name, mb/t, tokens, (double)source.size()/(1024*1024), t);
+}
+
+/// Time one way of converting numbers, returning a checksum so the work isn't optimised away
+#define TIME_CONVERSION(NAME, COUNT, EXPRESSION) { \
+  clock_t start = clock(); \
+  double check = 0; \
+  for (int i=0;i<(COUNT);i++) { EXPRESSION; } \
+  double t = seconds(start); \
+  printf("%-26s %7.1f M/s  (check %g)\n", NAME, (COUNT)/t/1000000, check); \
+}
+
+/// Compare writing and reading numbers with sprintf/strtod against formatNumber/parseNumber
+static void benchmarkNumbers(int count) {
+  std::vector<double> doubles(count);
+  std::vector<long> ints(count);
+  std::vector<std::string> doubleStrings(count), intStrings(count);
+  srand(1234);
+  for (int i=0;i<count;i++) {
+    ints[i] = rand() - RAND_MAX/2;
+    // half with all their digits, and half like the numbers people write
+    doubles[i] = (i&1) ? (double)rand() / (1 + rand()%10000) : (rand()%100000) / 100.0;
+    char buf[TINYJS_NUMBER_BUFFER];
+    TinyJS::formatNumber(buf, doubles[i]);
+    doubleStrings[i] = buf;
+    TinyJS::formatInteger(buf, ints[i]);
+    intStrings[i] = buf;
+  }
+  char buf[64];
+  TIME_CONVERSION("sprintf(\"%ld\")", count, check += sprintf(buf, "%ld", ints[i]));
+  TIME_CONVERSION("formatInteger", count, check += TinyJS::formatInteger(buf, ints[i]));
+  TIME_CONVERSION("sprintf(\"%f\")", count, check += sprintf(buf, "%f", doubles[i]));
+  TIME_CONVERSION("sprintf(\"%.17g\") (exact)", count, check += sprintf(buf, "%.17g", doubles[i]));
+  TIME_CONVERSION("formatNumber (shortest)", count, check += TinyJS::formatNumber(buf, doubles[i]));
+  TIME_CONVERSION("strtol", count, check += strtol(intStrings[i].c_str(), 0, 0));
+  TIME_CONVERSION("parseInteger", count, check += TinyJS::parseInteger(intStrings[i].c_str()));
+  TIME_CONVERSION("strtod", count, check += strtod(doubleStrings[i].c_str(), 0));
+  TIME_CONVERSION("parseNumber", count, check += TinyJS::parseNumber(doubleStrings[i].c_str()));
+}
+
+/// The given chunk of source, repeated to make about the given number of megabytes
+static std::string makeSource(const char *chunk, int megabytes) {
+  std::string source;
+  source.reserve((size_t)megabytes*1024*1024 + strlen(chunk));
+  while (source.size() < (size_t)megabytes*1024*1024)
+    source += chunk;
+  return source;
+}
+
+int main(int argc, char **argv) {
+  printf("TinyJS benchmarks\n");
+  printf("USAGE:\n");
+  printf("   ./Benchmark [megabytes]   : time the lexer on sources of the given size (default 8), and number conversions\n");
+  int megabytes = argc>1 ? atoi(argv[1]) : 8;
+  if (megabytes < 1) megabytes = 1;
+
+  printf("Scanning with %s kernels\n", TinyJS::Lexer::getScanKernels());
+  benchmarkLexer("code", makeSource(benchmarkSource, megabytes), 4);
+  benchmarkLexer("config", makeSource(configSource, megabytes), 4);
+  benchmarkNumbers(1000000);
+  return 0;
+}
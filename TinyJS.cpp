@@ -104,6 +104,37 @@
                    Fixed postfix increment operator
    Version 0.32 :  Fixed Math.randInt on 32 bit PCs, where it was broken
    Version 0.33 :  Fixed Memory leak + brokenness on === comparison
+   Version 0.34 :  Scripts are parsed once into a syntax tree and then walked (ENGINE_AST)
+   Version 0.35 :  Syntax trees are compiled to bytecode for a register based VM (ENGINE_VM)
+                   Loops in ENGINE_LEGACY are only lexed again once, rather than every time round
+                   The Lexer splits its whole input into a table of tokens up front
+                   Blocks that aren't executed are skipped in one step, using a table of matching braces
+                   Objects have shapes, and the VM caches where it found properties for each shape
+                   Variables with lots of children index them with a hash table
+                   Array elements are also kept in a vector, so indexing and length are O(1)
+                   Variables and VariableLinks come from thread local pools (TINYJS_USE_POOLS)
+                   Maths on numbers is done without allocating, and +=, -=, ++ and -- work in place
+                   The VM keeps numbers, null and undefined in its registers (NaN boxed)
+                   Variables keep their value in a union and the rest out of line, and link names are interned
+                   Names are atoms made by the Lexer, so finding a child or a scope compares pointers
+                   Lexer finds reserved words with a perfect hash, classes characters with a table,
+                   and slices tokens out of the source rather than adding a character at a time
+                   Lexer skips whitespace and comments and finds the ends of identifiers and strings
+                   with SSE2/AVX2 where the CPU has them (TINYJS_USE_SIMD)
+                   Source is shared: sub-lexers, loops and function bodies point into it rather than
+                   copying it, and its tokens are only made once
+                   Line and column come from a table of line starts, and the call stack (TINYJS_CALL_STACK)
+                   keeps (function, position) and is only turned into text for an error
+                   Numbers are written as JavaScript does (digits that read back as the same double)
+                   without sprintf, and read without strtol/strtod in the common cases
+                   String data is shared between copies, and adding long strings makes a rope
+                   (TINYJS_ROPE_MIN_LENGTH) that is only flattened when its characters are used
+                   Natives and comparisons read strings through getStringView rather than copying them
+                   String literals share one copy of their characters (Name::getLiteral), copied on change
+                   undefined, null and small ints (so true/false) are immortal shared constants, copied
+                   when stored; reading an array hole no longer leaks a Variable; a<<b doesn't change a
+                   Function calls keep this, the arguments and the result in a CallFrame on the C++ stack,
+                   and natives can take their arguments by position (JSNativeCallback) with no scope
 
     NOTE:
           Constructing an array with an initial length 'Array(5)' doesn't work
@@ -111,7 +142,7 @@
           length variable cannot be set
           The postfix increment operator returns the current value, not the previous as it should.
           There is no prefix increment operator
-          Arrays are implemented as a linked list - hence a lookup time is O(n)
+          Arrays are implemented as a linked list - very sparse ones have a lookup time of O(n)
 
     TODO:
           Utility va-args style function in TinyJS for executing a function directly
@@ -121,6 +152,7 @@
  */
 
 #include "TinyJS.h"
+#include "TinyJS_AST.h"
 #include <assert.h>
 
 #ifndef ASSERT
@@ -134,9 +166,14 @@
 
 #include <string>
 #include <string.h>
+#include <limits>
 #include <sstream>
 #include <cstdlib>
+#include <new>
 #include <stdio.h>
+#if TINYJS_USE_SIMD
+  #include <immintrin.h>
+#endif
 
 #if defined(_WIN32) && !defined(_WIN32_WCE)
 #ifdef _DEBUG
@@ -213,13 +250,112 @@ void show_allocated() {
 }
 #endif
 
+// ----------------------------------------------------------------------------------- POOL
+
+void *Pool::allocate(size_t size) {
+    stats.allocations++;
+    stats.inUse++;
+    if (freeList) {
+      void *block = freeList;
+      freeList = *(void**)block;
+      return block;
+    }
+    // keep blocks aligned for pointers and doubles
+    size = (size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+    if (next + size > end) {
+      char *slab = (char*)malloc(TINYJS_POOL_SLAB_SIZE);
+      if (!slab) throw std::bad_alloc();
+      stats.slabs++;
+      stats.bytes += TINYJS_POOL_SLAB_SIZE;
+      next = slab;
+      end = slab + TINYJS_POOL_SLAB_SIZE;
+    }
+    void *block = next;
+    next += size;
+    return block;
+}
+
+void Pool::release(void *block) {
+    if (!block) return;
+    stats.frees++;
+    stats.inUse--;
+    *(void**)block = freeList;
+    freeList = block;
+}
+
+#if TINYJS_USE_POOLS
+static TINYJS_THREAD_LOCAL Pool variablePool;
+static TINYJS_THREAD_LOCAL Pool linkPool;
+
+#ifdef DBG_NEW
+  // don't let the debug 'new' macro rename our operators
+  #pragma push_macro("new")
+  #undef new
+#endif
+
+void *VariableLink::operator new(size_t size) {
+    // anything derived from us is bigger, and doesn't fit the pool's blocks
+    if (size != sizeof(VariableLink)) return ::operator new(size);
+    return linkPool.allocate(size);
+}
+
+void VariableLink::operator delete(void *p, size_t size) {
+    if (size != sizeof(VariableLink)) ::operator delete(p);
+    else linkPool.release(p);
+}
+
+void *Variable::operator new(size_t size) {
+    if (size != sizeof(Variable)) return ::operator new(size);
+    return variablePool.allocate(size);
+}
+
+void Variable::operator delete(void *p, size_t size) {
+    if (size != sizeof(Variable)) ::operator delete(p);
+    else variablePool.release(p);
+}
+
+#ifdef DBG_NEW
+  #pragma pop_macro("new")
+#endif
+#endif
+
+
 // ----------------------------------------------------------------------------------- Utils
+/// Character classes, as bits in charClasses
+enum CHAR_CLASSES {
+    CHAR_WHITESPACE = 1,
+    CHAR_ALPHA = 2, ///< letters and '_'
+    CHAR_NUMERIC = 4,
+    CHAR_HEXADECIMAL = 8,
+};
+// Build the class table when compiling, 4/16/64 characters at a time
+#define CHAR_CLASS(ch) ( \
+    (((ch)==' ' || (ch)=='\t' || (ch)=='\n' || (ch)=='\r') ? CHAR_WHITESPACE : 0) | \
+    ((((ch)>='a' && (ch)<='z') || ((ch)>='A' && (ch)<='Z') || (ch)=='_') ? CHAR_ALPHA : 0) | \
+    (((ch)>='0' && (ch)<='9') ? CHAR_NUMERIC : 0) | \
+    ((((ch)>='0' && (ch)<='9') || ((ch)>='a' && (ch)<='f') || ((ch)>='A' && (ch)<='F')) ? CHAR_HEXADECIMAL : 0))
+#define CHAR_CLASS4(ch) CHAR_CLASS(ch), CHAR_CLASS((ch)+1), CHAR_CLASS((ch)+2), CHAR_CLASS((ch)+3)
+#define CHAR_CLASS16(ch) CHAR_CLASS4(ch), CHAR_CLASS4((ch)+4), CHAR_CLASS4((ch)+8), CHAR_CLASS4((ch)+12)
+#define CHAR_CLASS64(ch) CHAR_CLASS16(ch), CHAR_CLASS16((ch)+16), CHAR_CLASS16((ch)+32), CHAR_CLASS16((ch)+48)
+/// The classes of each character, so the lexer tests one with a single lookup (nothing above 127 is in a class)
+static const unsigned char charClasses[256] = {
+    CHAR_CLASS64(0), CHAR_CLASS64(64), CHAR_CLASS64(128), CHAR_CLASS64(192)
+};
+#undef CHAR_CLASS64
+#undef CHAR_CLASS16
+#undef CHAR_CLASS4
+#undef CHAR_CLASS
+
+static inline bool isCharClass(char ch, int charClass) {
+    return (charClasses[(unsigned char)ch] & charClass) != 0;
+}
+
 bool isWhitespace(char ch) {
-    return (ch==' ') || (ch=='\t') || (ch=='\n') || (ch=='\r');
+    return isCharClass(ch, CHAR_WHITESPACE);
 }
 
 bool isNumeric(char ch) {
-    return (ch>='0') && (ch<='9');
+    return isCharClass(ch, CHAR_NUMERIC);
 }
 bool isNumber(const std::string &str) {
     for (size_t i=0;i<str.size();i++)
@@ -227,12 +363,10 @@ bool isNumber(const std::string &str) {
     return true;
 }
 bool isHexadecimal(char ch) {
-    return ((ch>='0') && (ch<='9')) ||
-           ((ch>='a') && (ch<='f')) ||
-           ((ch>='A') && (ch<='F'));
+    return isCharClass(ch, CHAR_HEXADECIMAL);
 }
 bool isAlpha(char ch) {
-    return ((ch>='a') && (ch<='z')) || ((ch>='A') && (ch<='Z')) || ch=='_';
+    return isCharClass(ch, CHAR_ALPHA);
 }
 
 void replace(std::string &str, char textFrom, const char *textTo) {
@@ -285,46 +419,652 @@ bool isAlphaNum(const std::string &str) {
     return true;
 }
 
+// ----------------------------------------------------------------------------------- NUMBERS
+/* Numbers are written with formatNumber, which finds digits that round-trip
+ * (read back as the same double) using Grisu2 (Florian Loitsch, "Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers", 2010), and
+ * lays them out as JavaScript's Number toString does. */
+
+#define DIYFP_FRACTION_MASK 0x000FFFFFFFFFFFFFULL ///< Bits of a double's fraction
+#define DIYFP_HIDDEN_BIT 0x0010000000000000ULL ///< The implicit leading bit of a normal double's significand
+
+/// A floating point number as a 64 bit significand and a binary exponent
+class DiyFp
+{
+public:
+    DiyFp() : f(0), e(0) {}
+    DiyFp(unsigned long long f, int e) : f(f), e(e) {}
+    explicit DiyFp(double d) {
+      unsigned long long bits;
+      memcpy(&bits, &d, sizeof(bits));
+      int biasedE = (int)((bits >> 52) & 0x7FF);
+      f = bits & DIYFP_FRACTION_MASK;
+      if (biasedE) {
+        f += DIYFP_HIDDEN_BIT;
+        e = biasedE - 1075;
+      } else
+        e = -1074;
+    }
+
+    unsigned long long f;
+    int e;
+
+    DiyFp operator-(const DiyFp &rhs) const { return DiyFp(f - rhs.f, e); }
+    /// Multiply, rounding to the top 64 bits of the result
+    DiyFp operator*(const DiyFp &rhs) const {
+      const unsigned long long M32 = 0xFFFFFFFFULL;
+      unsigned long long a = f >> 32, b = f & M32, c = rhs.f >> 32, d = rhs.f & M32;
+      unsigned long long ac = a*c, bc = b*c, ad = a*d, bd = b*d;
+      unsigned long long tmp = (bd >> 32) + (ad & M32) + (bc & M32) + (1ULL << 31);
+      return DiyFp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), e + rhs.e + 64);
+    }
+    DiyFp normalize() const {
+      DiyFp r = *this;
+      while (!(r.f & (1ULL << 63))) { r.f <<= 1; r.e--; }
+      return r;
+    }
+    /// The numbers half way to the doubles either side of this one, normalized to the same exponent
+    void getBoundaries(DiyFp &minus, DiyFp &plus) const {
+      plus = DiyFp((f << 1) + 1, e - 1);
+      while (!(plus.f & (DIYFP_HIDDEN_BIT << 1))) { plus.f <<= 1; plus.e--; }
+      plus.f <<= 10;
+      plus.e -= 10;
+      minus = (f == DIYFP_HIDDEN_BIT) ? DiyFp((f << 2) - 1, e - 2) : DiyFp((f << 1) - 1, e - 1);
+      minus.f <<= minus.e - plus.e;
+      minus.e = plus.e;
+    }
+};
+
+/// Normalized 10^(8i-348), for Grisu's choice of power of 10
+static const unsigned long long cachedPowerF[87] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL, 0xcf42894a5dce35eaULL,
+    0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL, 0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL,
+    0xbe5691ef416bd60cULL, 0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL, 0xc21094364dfb5637ULL,
+    0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL, 0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL,
+    0xb23867fb2a35b28eULL, 0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL, 0xb5b5ada8aaff80b8ULL,
+    0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL, 0x964e858c91ba2655ULL, 0xdff9772470297ebdULL,
+    0xa6dfbd9fb8e5b88fULL, 0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL, 0xaa242499697392d3ULL,
+    0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL, 0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL,
+    0x9c40000000000000ULL, 0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL, 0x9f4f2726179a2245ULL,
+    0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL, 0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL,
+    0x924d692ca61be758ULL, 0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL, 0x952ab45cfa97a0b3ULL,
+    0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL, 0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL,
+    0x88fcf317f22241e2ULL, 0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL, 0x8bab8eefb6409c1aULL,
+    0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL, 0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL,
+    0x80444b5e7aa7cf85ULL, 0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+static const short cachedPowerE[87] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066
+};
+
+/// A cached power of 10 that brings a number with binary exponent e into range, and its decimal exponent (negated) in K
+static DiyFp getCachedPower(int e, int &K) {
+    double dk = (-61 - e) * 0.30102999566398114 + 347;
+    int k = (int)dk;
+    if (dk - k > 0.0) k++;
+    int index = (k >> 3) + 1;
+    K = -(-348 + index*8);
+    return DiyFp(cachedPowerF[index], cachedPowerE[index]);
+}
+
+static const unsigned int pow10Int[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+static void grisuRound(char *buffer, int len, unsigned long long delta, unsigned long long rest, unsigned long long tenKappa, unsigned long long wpw) {
+    while (rest < wpw && delta - rest >= tenKappa &&
+           (rest + tenKappa < wpw || wpw - rest > rest + tenKappa - wpw)) {
+      buffer[len-1]--;
+      rest += tenKappa;
+    }
+}
+
+/// Generate the digits of W, stopping as soon as they are within delta of Mp
+static void grisuDigits(const DiyFp &W, const DiyFp &Mp, unsigned long long delta, char *buffer, int &len, int &K) {
+    const DiyFp one(1ULL << -Mp.e, Mp.e);
+    const DiyFp wpw = Mp - W;
+    unsigned int p1 = (unsigned int)(Mp.f >> -one.e);
+    unsigned long long p2 = Mp.f & (one.f - 1);
+    int kappa = 1;
+    while (kappa < 10 && p1 >= pow10Int[kappa]) kappa++;
+    len = 0;
+    while (kappa > 0) {
+      unsigned int d = p1 / pow10Int[kappa-1];
+      p1 %= pow10Int[kappa-1];
+      if (d || len) buffer[len++] = (char)('0' + d);
+      kappa--;
+      unsigned long long tmp = ((unsigned long long)p1 << -one.e) + p2;
+      if (tmp <= delta) {
+        K += kappa;
+        grisuRound(buffer, len, delta, tmp, (unsigned long long)pow10Int[kappa] << -one.e, wpw.f);
+        return;
+      }
+    }
+    while (true) {
+      p2 *= 10;
+      delta *= 10;
+      char d = (char)(p2 >> -one.e);
+      if (d || len) buffer[len++] = (char)('0' + d);
+      p2 &= one.f - 1;
+      kappa--;
+      if (p2 < delta) {
+        K += kappa;
+        int index = -kappa;
+        grisuRound(buffer, len, delta, p2, one.f, wpw.f * (index < 10 ? pow10Int[index] : 0));
+        return;
+      }
+    }
+}
+
+/// Write digits that read back as value (which is finite and > 0), returning their count. value is digits*10^K.
+static int grisu2(double value, char *buffer, int &K) {
+    const DiyFp v(value);
+    DiyFp wMinus, wPlus;
+    v.getBoundaries(wMinus, wPlus);
+    const DiyFp cMK = getCachedPower(wPlus.e, K);
+    const DiyFp W = v.normalize() * cMK;
+    DiyFp Wp = wPlus * cMK;
+    DiyFp Wm = wMinus * cMK;
+    Wm.f++;
+    Wp.f--;
+    int len;
+    grisuDigits(W, Wp, Wp.f - Wm.f, buffer, len, K);
+    return len;
+}
+
+static const char digitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+int formatInteger(char *buf, long value) {
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    unsigned long u = value<0 ? 0UL-(unsigned long)value : (unsigned long)value;
+    while (u >= 100) {
+      const char *pair = &digitPairs[(u % 100) * 2];
+      u /= 100;
+      *--p = pair[1];
+      *--p = pair[0];
+    }
+    if (u >= 10) {
+      *--p = digitPairs[u*2+1];
+      *--p = digitPairs[u*2];
+    } else
+      *--p = (char)('0' + u);
+    if (value<0) *--p = '-';
+    int len = (int)(tmp + sizeof(tmp) - p);
+    memcpy(buf, p, len);
+    buf[len] = 0;
+    return len;
+}
+
+int formatNumber(char *buf, double value) {
+    if (value != value) { strcpy(buf, "NaN"); return 3; }
+    char *p = buf;
+    if (value < 0) { *p++ = '-'; value = -value; }
+    if (value == 0) { strcpy(buf, "0"); return 1; } // -0 as well
+    if (value > 1.7976931348623157e308) { strcpy(p, "Infinity"); return (int)(p-buf) + 8; }
+    char digits[20];
+    int K = 0;
+    int len = grisu2(value, digits, K);
+    int n = len + K; // value is 0.digits * 10^n
+    if (len <= n && n <= 21) { // an integer: digits, then zeros
+      memcpy(p, digits, len);
+      memset(p+len, '0', n-len);
+      p += n;
+    } else if (0 < n && n <= 21) { // digits with a decimal point inside them
+      memcpy(p, digits, n);
+      p[n] = '.';
+      memcpy(p+n+1, digits+n, len-n);
+      p += len+1;
+    } else if (-6 < n && n <= 0) { // 0.000digits
+      p[0] = '0';
+      p[1] = '.';
+      memset(p+2, '0', -n);
+      memcpy(p+2-n, digits, len);
+      p += 2-n+len;
+    } else { // d.ddde+x
+      *p++ = digits[0];
+      if (len > 1) {
+        *p++ = '.';
+        memcpy(p, digits+1, len-1);
+        p += len-1;
+      }
+      *p++ = 'e';
+      *p++ = n-1 < 0 ? '-' : '+';
+      p += formatInteger(p, n-1 < 0 ? 1-n : n-1);
+    }
+    *p = 0;
+    return (int)(p-buf);
+}
+
+long parseInteger(const char *str, const char **end) {
+    const char *p = str;
+    while (isWhitespace(*p)) p++;
+    bool negative = *p=='-';
+    if (*p=='-' || *p=='+') p++;
+    // leave hex, octal and anything that could overflow to strtol
+    if (!isNumeric(*p) || (*p=='0' && (p[1]=='x' || p[1]=='X' || isNumeric(p[1])))) {
+      char *e;
+      long value = strtol(str, &e, 0);
+      if (end) *end = e;
+      return value;
+    }
+    const char *digits = p;
+    unsigned long value = 0;
+    while (isNumeric(*p)) value = value*10 + (*p++ - '0');
+    // any number with up to digits10 digits fits in a long (9 where it is 32 bits, 18 for 64)
+    if (p - digits > std::numeric_limits<long>::digits10) {
+      char *e;
+      long value = strtol(str, &e, 0);
+      if (end) *end = e;
+      return value;
+    }
+    if (end) *end = p;
+    return negative ? -(long)value : (long)value;
+}
+
+double parseNumber(const char *str, const char **end) {
+    /* Clinger's fast path: with at most 19 significant digits making an integer
+     * below 2^53, and a power of ten below 10^23 (both exact as doubles),
+     * one multiply or divide gives the correctly rounded result */
+    static const double pow10Double[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char *p = str;
+    while (isWhitespace(*p)) p++;
+    bool negative = *p=='-';
+    if (*p=='-' || *p=='+') p++;
+    unsigned long long mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    while (*p=='0') { p++; any = true; } // leading zeros aren't significant
+    if (*p=='x' || *p=='X') digits = 20; // hex - leave to strtod
+    while (isNumeric(*p)) {
+      if (digits < 19) mantissa = mantissa*10 + (*p - '0'); else exponent++;
+      digits++; p++; any = true;
+    }
+    if (*p=='.') {
+      p++;
+      if (!mantissa) while (*p=='0') { p++; exponent--; any = true; }
+      while (isNumeric(*p)) {
+        if (digits < 19) { mantissa = mantissa*10 + (*p - '0'); exponent--; }
+        digits++; p++; any = true;
+      }
+    }
+    if (any && (*p=='e' || *p=='E')) {
+      const char *e = p+1;
+      bool negativeExponent = *e=='-';
+      if (*e=='-' || *e=='+') e++;
+      if (isNumeric(*e)) {
+        int x = 0;
+        while (isNumeric(*e)) { if (x < 10000) x = x*10 + (*e - '0'); e++; }
+        exponent += negativeExponent ? -x : x;
+        p = e;
+      }
+    }
+    if (!any || digits > 19 || mantissa > (1ULL << 53) || exponent < -22 || exponent > 22) {
+      char *e;
+      double value = strtod(str, &e);
+      if (end) *end = e;
+      return value;
+    }
+    double value = (double)mantissa;
+    if (exponent < 0) value /= pow10Double[-exponent]; else value *= pow10Double[exponent];
+    if (end) *end = p;
+    return negative ? -value : value;
+}
+
 // ----------------------------------------------------------------------------------- EXCEPTION
 
 Exception::Exception(const std::string &exceptionText)
     : text(exceptionText) {
 }
 
+// ----------------------------------------------------------------------------------- SCAN KERNELS
+/* Each kernel scans data from pos, and returns where the run it is looking
+ * at ends (or end). The SIMD versions look at 16 or 32 characters at a time
+ * and leave anything shorter at the end to the scalar ones, so they never
+ * read past end. */
+
+static int scanWhitespaceScalar(const char *data, int pos, int end) {
+    while (pos<end && isCharClass(data[pos], CHAR_WHITESPACE)) pos++;
+    return pos;
+}
+static int scanIdentifierScalar(const char *data, int pos, int end) {
+    while (pos<end && isCharClass(data[pos], CHAR_ALPHA|CHAR_NUMERIC)) pos++;
+    return pos;
+}
+static int scanUntilScalar(const char *data, int pos, int end, char a, char b) {
+    while (pos<end && data[pos]!=a && data[pos]!=b) pos++;
+    return pos;
+}
+
+#if TINYJS_USE_SIMD
+/* Bytes from lo to lo+count-1 in x. Adding 0x80-lo moves that range to the
+ * bottom of the signed range, so one signed compare tests both ends. */
+#define SIMD_IN_RANGE(BITS, x, lo, count) \
+    _mm##BITS##_cmpgt_epi8(_mm##BITS##_set1_epi8((char)(0x80+(count))), \
+                           _mm##BITS##_add_epi8(x, _mm##BITS##_set1_epi8((char)(0x80-(lo)))))
+#define SIMD_EQUAL(BITS, x, ch) _mm##BITS##_cmpeq_epi8(x, _mm##BITS##_set1_epi8(ch))
+
+static int scanWhitespaceSSE2(const char *data, int pos, int end) {
+    for (;pos+16<=end;pos+=16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(data+pos));
+        __m128i ws = _mm_or_si128(_mm_or_si128(SIMD_EQUAL(, x, ' '), SIMD_EQUAL(, x, '\t')),
+                                  _mm_or_si128(SIMD_EQUAL(, x, '\n'), SIMD_EQUAL(, x, '\r')));
+        unsigned int other = ~_mm_movemask_epi8(ws) & 0xFFFF;
+        if (other) return pos + __builtin_ctz(other);
+    }
+    return scanWhitespaceScalar(data, pos, end);
+}
+static int scanIdentifierSSE2(const char *data, int pos, int end) {
+    for (;pos+16<=end;pos+=16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(data+pos));
+        __m128i letters = SIMD_IN_RANGE(, _mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 26); // either case
+        __m128i id = _mm_or_si128(_mm_or_si128(letters, SIMD_IN_RANGE(, x, '0', 10)), SIMD_EQUAL(, x, '_'));
+        unsigned int other = ~_mm_movemask_epi8(id) & 0xFFFF;
+        if (other) return pos + __builtin_ctz(other);
+    }
+    return scanIdentifierScalar(data, pos, end);
+}
+static int scanUntilSSE2(const char *data, int pos, int end, char a, char b) {
+    for (;pos+16<=end;pos+=16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(data+pos));
+        unsigned int found = _mm_movemask_epi8(_mm_or_si128(SIMD_EQUAL(, x, a), SIMD_EQUAL(, x, b)));
+        if (found) return pos + __builtin_ctz(found);
+    }
+    return scanUntilScalar(data, pos, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static int scanWhitespaceAVX2(const char *data, int pos, int end) {
+    for (;pos+32<=end;pos+=32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(data+pos));
+        __m256i ws = _mm256_or_si256(_mm256_or_si256(SIMD_EQUAL(256, x, ' '), SIMD_EQUAL(256, x, '\t')),
+                                     _mm256_or_si256(SIMD_EQUAL(256, x, '\n'), SIMD_EQUAL(256, x, '\r')));
+        unsigned int other = ~(unsigned int)_mm256_movemask_epi8(ws);
+        if (other) return pos + __builtin_ctz(other);
+    }
+    return scanWhitespaceSSE2(data, pos, end);
+}
+__attribute__((target("avx2")))
+static int scanIdentifierAVX2(const char *data, int pos, int end) {
+    for (;pos+32<=end;pos+=32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(data+pos));
+        __m256i letters = SIMD_IN_RANGE(256, _mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 26);
+        __m256i id = _mm256_or_si256(_mm256_or_si256(letters, SIMD_IN_RANGE(256, x, '0', 10)), SIMD_EQUAL(256, x, '_'));
+        unsigned int other = ~(unsigned int)_mm256_movemask_epi8(id);
+        if (other) return pos + __builtin_ctz(other);
+    }
+    return scanIdentifierSSE2(data, pos, end);
+}
+__attribute__((target("avx2")))
+static int scanUntilAVX2(const char *data, int pos, int end, char a, char b) {
+    for (;pos+32<=end;pos+=32) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(data+pos));
+        unsigned int found = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(SIMD_EQUAL(256, x, a), SIMD_EQUAL(256, x, b)));
+        if (found) return pos + __builtin_ctz(found);
+    }
+    return scanUntilSSE2(data, pos, end, a, b);
+}
+#undef SIMD_EQUAL
+#undef SIMD_IN_RANGE
+#endif
+
+/// The scan kernels the Lexer uses
+class ScanKernels {
+public:
+    const char *name;
+    int (*whitespace)(const char *data, int pos, int end); ///< Skip whitespace
+    int (*identifier)(const char *data, int pos, int end); ///< Skip letters, digits and '_'
+    int (*until)(const char *data, int pos, int end, char a, char b); ///< Find the first a or b
+
+    ScanKernels() {
+        name = "scalar";
+        whitespace = scanWhitespaceScalar;
+        identifier = scanIdentifierScalar;
+        until = scanUntilScalar;
+#if TINYJS_USE_SIMD
+        if (__builtin_cpu_supports("avx2")) {
+            name = "avx2";
+            whitespace = scanWhitespaceAVX2;
+            identifier = scanIdentifierAVX2;
+            until = scanUntilAVX2;
+        } else {
+            name = "sse2";
+            whitespace = scanWhitespaceSSE2;
+            identifier = scanIdentifierSSE2;
+            until = scanUntilSSE2;
+        }
+#endif
+    }
+};
+
+/// Picked the first time they are needed (after any other static constructors have run)
+static const ScanKernels &scanKernels() {
+    static ScanKernels kernels;
+    return kernels;
+}
+
 // ----------------------------------------------------------------------------------- LEXER
 
+int StringView::find(const StringView &search, int from) const {
+    if (search.length==0) return from<=length ? from : -1;
+    const char *last = data + length - search.length;
+    for (const char *p = data+from; p<=last; p++) {
+      p = (const char*)memchr(p, search.data[0], last-p+1);
+      if (!p) return -1;
+      if (memcmp(p, search.data, search.length)==0) return (int)(p-data);
+    }
+    return -1;
+}
+
+int StringView::compare(const StringView &other) const {
+    int common = length<other.length ? length : other.length;
+    int c = common ? memcmp(data, other.data, common) : 0;
+    if (c) return c;
+    return length - other.length;
+}
+
+Source::Source(const std::string &text) {
+    char *copy = (char*)malloc(text.size()+1);
+    memcpy(copy, text.c_str(), text.size()+1);
+    data = copy;
+    length = (int)text.size();
+    tokenized = false;
+    refs = 0;
+}
+
+Source::~Source() {
+    free((void*)data);
+}
+
+Source *Source::ref() {
+    refs++;
+    return this;
+}
+
+void Source::unref() {
+    if ((--refs)==0)
+      delete this;
+}
+
+std::string Source::getPosition(int pos) {
+    if (lineStarts.empty()) {
+      lineStarts.push_back(0);
+      for (int i=0;i<length;i++)
+        if (data[i]=='\n') lineStarts.push_back(i+1);
+    }
+    // find the last line starting at or before pos
+    int lo = 0, hi = (int)lineStarts.size();
+    while (hi-lo > 1) {
+      int mid = (lo+hi)/2;
+      if (lineStarts[mid] <= pos) lo = mid; else hi = mid;
+    }
+    // columns are counted as formatPosition does
+    int col = lo ? pos-lineStarts[lo] : pos+1;
+    char buf[256];
+    sprintf_s(buf, 256, "(line: %d, col: %d)", lo+1, col);
+    return buf;
+}
+
+SourceSlice::SourceSlice(Source *source, int start, int end)
+    : source(source ? source->ref() : 0), start(start), end(end) {
+}
+
+SourceSlice::SourceSlice(const SourceSlice &slice)
+    : source(slice.source ? slice.source->ref() : 0), start(slice.start), end(slice.end) {
+}
+
+SourceSlice::~SourceSlice() {
+    if (source) source->unref();
+}
+
+SourceSlice &SourceSlice::operator=(const SourceSlice &slice) {
+    if (slice.source) slice.source->ref();
+    if (source) source->unref();
+    source = slice.source;
+    start = slice.start;
+    end = slice.end;
+    return *this;
+}
+
 Lexer::Lexer(const std::string &input) {
-    data = _strdup(input.c_str());
-    dataOwned = true;
-    dataStart = 0;
-    dataEnd = strlen(data);
-    reset();
+    Source *s = new Source(input);
+    init(s, 0, s->length);
+}
+
+Lexer::Lexer(const SourceSlice &slice) {
+    if (slice.source)
+      init(slice.source, slice.start, slice.end);
+    else
+      init(new Source(""), 0, 0);
 }
 
 Lexer::Lexer(Lexer *owner, int startChar, int endChar) {
-    data = owner->data;
-    dataOwned = false;
-    dataStart = startChar;
-    dataEnd = endChar;
-    reset();
+    init(owner->source, startChar, endChar);
 }
 
 Lexer::~Lexer(void)
 {
-    if (dataOwned)
-        free((void*)data);
+    source->unref();
 }
 
-void Lexer::reset() {
+void Lexer::init(Source *s, int startChar, int endChar) {
+    source = s->ref();
+    data = source->data;
+    if (!source->tokenized) {
+      dataStart = 0;
+      dataEnd = source->length;
+      tokenize();
+      source->tokenized = true;
+    }
+    dataStart = startChar;
+    dataEnd = endChar;
+    // find the tokens that lie completely within our part of the data (both ends are in order)
+    const std::vector<Token> &tokens = source->tokens;
+    int lo = 0, hi = (int)tokens.size();
+    while (lo < hi) {
+      int mid = (lo+hi)/2;
+      if (tokens[mid].start < startChar) lo = mid+1; else hi = mid;
+    }
+    firstToken = lo;
+    hi = (int)tokens.size();
+    while (lo < hi) {
+      int mid = (lo+hi)/2;
+      if (tokens[mid].end < endChar) lo = mid+1; else hi = mid;
+    }
+    lastToken = lo;
+    reset();
+}
+
+void Lexer::tokenize() {
+    std::vector<Token> &tokens = source->tokens;
+    std::vector<int> openBraces;
     dataPos = dataStart;
-    tokenStart = 0;
-    tokenEnd = 0;
-    tokenLastEnd = 0;
-    tk = 0;
-    tkStr = "";
+    currCh = nextCh = 0;
     getNextCh();
     getNextCh();
-    getNextToken();
+    while (true) {
+      getNextToken();
+      if (tk == LEXER_EOF) break;
+      Token token;
+      token.tk = tk;
+      token.start = tokenStart;
+      token.end = tokenEnd;
+      token.match = -1;
+      token.intValue = 0;
+      // pair up braces, so blocks that aren't executed can be skipped in one go
+      if (tk=='{') {
+        openBraces.push_back((int)tokens.size());
+      } else if (tk=='}' && !openBraces.empty()) {
+        tokens[openBraces.back()].match = (int)tokens.size();
+        openBraces.pop_back();
+      } else if (tk==LEXER_ID || tk==LEXER_STR)
+        token.name = scanStr;
+      else if (tk==LEXER_INT)
+        token.intValue = parseInteger(scanStr.c_str());
+      else if (tk==LEXER_FLOAT)
+        token.floatValue = parseNumber(scanStr.c_str());
+      tokens.push_back(token);
+    }
+    scanStr.clear();
+}
+
+void Lexer::reset() {
+    eof.tk = LEXER_EOF;
+    eof.start = dataEnd;
+    eof.end = dataEnd-1;
+    eof.match = -1;
+    eof.intValue = 0;
+    tokenEnd = 0;
+    setToken(firstToken);
+}
+
+void Lexer::setToken(int index) {
+    tokenIndex = index;
+    const Token &token = getToken();
+    tk = token.tk;
+    tokenStart = token.start;
+    tokenLastEnd = tokenEnd;
+    tokenEnd = token.end;
+    tkName = token.name;
+    if (tk==LEXER_ID || tk==LEXER_STR)
+      tkStr = StringView(token.name.str().data(), (int)token.name.str().size());
+    else if (tk==LEXER_INT || tk==LEXER_FLOAT)
+      tkStr = StringView(&data[tokenStart], tokenEnd+1-tokenStart);
+    else
+      tkStr = StringView();
+}
+
+const Token &Lexer::getToken() const {
+    return tokenIndex < lastToken ? source->tokens[tokenIndex] : eof;
+}
+
+void Lexer::skipBlock() {
+    int close = source->tokens[tokenIndex].match;
+    match('{');
+    // a sub-lexer may end before the block does
+    if (close < 0 || close >= lastToken) close = lastToken-1;
+    if (close >= tokenIndex) {
+      tokenEnd = source->tokens[close].end;
+      setToken(close+1);
+    }
 }
 
 void Lexer::match(int expected_tk) {
@@ -334,7 +1074,8 @@ void Lexer::match(int expected_tk) {
          << " at " << getPosition(tokenStart);
         throw new Exception(errorString.str());
     }
-    getNextToken();
+    if (tokenIndex < lastToken)
+      setToken(tokenIndex+1);
 }
 
 std::string Lexer::getTokenStr(int token) {
@@ -392,6 +1133,35 @@ std::string Lexer::getTokenStr(int token) {
     return msg.str();
 }
 
+/// Reserved words, each at the index keywordHash gives it
+static const struct {
+    const char *word;
+    int tk;
+} keywords[32] = {
+    {"continue", LEXER_RESERVED_CONTINUE}, {"for", LEXER_RESERVED_FOR}, {0,0}, {0,0},
+    {0,0}, {"true", LEXER_RESERVED_TRUE}, {"null", LEXER_RESERVED_NULL}, {0,0},
+    {0,0}, {0,0}, {0,0}, {"while", LEXER_RESERVED_WHILE},
+    {"function", LEXER_RESERVED_FUNCTION}, {0,0}, {"new", LEXER_RESERVED_NEW}, {0,0},
+    {0,0}, {"var", LEXER_RESERVED_VAR}, {"return", LEXER_RESERVED_RETURN}, {0,0},
+    {"undefined", LEXER_RESERVED_UNDEFINED}, {"if", LEXER_RESERVED_IF}, {"else", LEXER_RESERVED_ELSE}, {0,0},
+    {0,0}, {"do", LEXER_RESERVED_DO}, {"false", LEXER_RESERVED_FALSE}, {0,0},
+    {"break", LEXER_RESERVED_BREAK}, {0,0}, {0,0}, {0,0},
+};
+
+/// A hash that gives every reserved word its own slot in keywords
+static inline int keywordHash(const char *str, int len) {
+    return ((unsigned char)str[0] + (unsigned char)str[len-1] + 3*len) & 31;
+}
+
+/// The token for an identifier - the reserved word it is, or LEXER_ID
+static int getKeywordToken(const char *str, int len) {
+    if (len<2 || len>9) return LEXER_ID; // shorter or longer than any reserved word
+    const char *word = keywords[keywordHash(str, len)].word;
+    if (word && strncmp(word, str, len)==0 && word[len]==0)
+        return keywords[keywordHash(str, len)].tk;
+    return LEXER_ID;
+}
+
 void Lexer::getNextCh() {
     currCh = nextCh;
     if (dataPos < dataEnd)
@@ -401,79 +1171,66 @@ void Lexer::getNextCh() {
     dataPos++;
 }
 
+const char *Lexer::getScanKernels() {
+    return scanKernels().name;
+}
+
+void Lexer::scanTo(int pos) {
+    currCh = pos<dataEnd ? data[pos] : 0;
+    nextCh = pos+1<dataEnd ? data[pos+1] : 0;
+    dataPos = pos+2;
+}
+
 void Lexer::getNextToken() {
     tk = LEXER_EOF;
-    tkStr.clear();
-    while (currCh && isWhitespace(currCh)) getNextCh();
-    // newline comments
-    if (currCh=='/' && nextCh=='/') {
-        while (currCh && currCh!='\n') getNextCh();
-        getNextCh();
-        getNextToken();
-        return;
-    }
-    // block comments
-    if (currCh=='/' && nextCh=='*') {
-        while (currCh && (currCh!='*' || nextCh!='/')) getNextCh();
-        getNextCh();
-        getNextCh();
-        getNextToken();
-        return;
+    scanStr.clear();
+    const ScanKernels &scan = scanKernels();
+    // skip whitespace and comments, working on data directly
+    int pos = dataPos-2; // where currCh is
+    while (true) {
+        if (pos<dataEnd && isWhitespace(data[pos]))
+            pos = scan.whitespace(data, pos+1, dataEnd);
+        if (pos+1>=dataEnd || data[pos]!='/') break;
+        if (data[pos+1]=='/') { // newline comments
+            pos = scan.until(data, pos, dataEnd, '\n', '\n') + 1;
+        } else if (data[pos+1]=='*') { // block comments
+            pos = scan.until(data, pos, dataEnd, '*', '*');
+            while (pos<dataEnd && (pos+1>=dataEnd || data[pos+1]!='/'))
+                pos = scan.until(data, pos+1, dataEnd, '*', '*');
+            pos+=2;
+        } else break;
     }
     // record beginning of this token
-    tokenStart = dataPos-2;
-    // tokens
+    tokenStart = pos;
+    scanTo(pos);
     if (isAlpha(currCh)) { //  IDs
-        while (isAlpha(currCh) || isNumeric(currCh)) {
-            tkStr += currCh;
-            getNextCh();
-        }
-        tk = LEXER_ID;
-             if (tkStr=="if") tk = LEXER_RESERVED_IF;
-        else if (tkStr=="else") tk = LEXER_RESERVED_ELSE;
-        else if (tkStr=="do") tk = LEXER_RESERVED_DO;
-        else if (tkStr=="while") tk = LEXER_RESERVED_WHILE;
-        else if (tkStr=="for") tk = LEXER_RESERVED_FOR;
-        else if (tkStr=="break") tk = LEXER_RESERVED_BREAK;
-        else if (tkStr=="continue") tk = LEXER_RESERVED_CONTINUE;
-        else if (tkStr=="function") tk = LEXER_RESERVED_FUNCTION;
-        else if (tkStr=="return") tk = LEXER_RESERVED_RETURN;
-        else if (tkStr=="var") tk = LEXER_RESERVED_VAR;
-        else if (tkStr=="true") tk = LEXER_RESERVED_TRUE;
-        else if (tkStr=="false") tk = LEXER_RESERVED_FALSE;
-        else if (tkStr=="null") tk = LEXER_RESERVED_NULL;
-        else if (tkStr=="undefined") tk = LEXER_RESERVED_UNDEFINED;
-        else if (tkStr=="new") tk = LEXER_RESERVED_NEW;
+        pos = scan.identifier(data, pos+1, dataEnd);
+        scanStr.assign(data+tokenStart, pos-tokenStart);
+        tk = getKeywordToken(data+tokenStart, pos-tokenStart);
+        scanTo(pos);
     } else if (isNumeric(currCh)) { // Numbers
         bool isHex = false;
-        if (currCh=='0') { tkStr += currCh; getNextCh(); }
-        if (currCh=='x') {
+        if (data[pos]=='0') pos++;
+        if (pos<dataEnd && data[pos]=='x') {
           isHex = true;
-          tkStr += currCh; getNextCh();
+          pos++;
         }
         tk = LEXER_INT;
-        while (isNumeric(currCh) || (isHex && isHexadecimal(currCh))) {
-            tkStr += currCh;
-            getNextCh();
-        }
-        if (!isHex && currCh=='.') {
+        while (pos<dataEnd && isCharClass(data[pos], isHex ? CHAR_HEXADECIMAL : CHAR_NUMERIC)) pos++;
+        if (!isHex && pos<dataEnd && data[pos]=='.') {
             tk = LEXER_FLOAT;
-            tkStr += '.';
-            getNextCh();
-            while (isNumeric(currCh)) {
-                tkStr += currCh;
-                getNextCh();
-            }
+            pos++;
+            while (pos<dataEnd && isNumeric(data[pos])) pos++;
         }
         // do fancy e-style floating point
-        if (!isHex && (currCh=='e'||currCh=='E')) {
+        if (!isHex && pos<dataEnd && (data[pos]=='e'||data[pos]=='E')) {
           tk = LEXER_FLOAT;
-          tkStr += currCh; getNextCh();
-          if (currCh=='-') { tkStr += currCh; getNextCh(); }
-          while (isNumeric(currCh)) {
-             tkStr += currCh; getNextCh();
-          }
+          pos++;
+          if (pos<dataEnd && data[pos]=='-') pos++;
+          while (pos<dataEnd && isNumeric(data[pos])) pos++;
         }
+        scanStr.assign(data+tokenStart, pos-tokenStart);
+        scanTo(pos);
     } else if (currCh=='"') {
         // strings...
         getNextCh();
@@ -481,15 +1238,18 @@ void Lexer::getNextToken() {
             if (currCh == '\\') {
                 getNextCh();
                 switch (currCh) {
-                case 'n' : tkStr += '\n'; break;
-                case '"' : tkStr += '"'; break;
-                case '\\' : tkStr += '\\'; break;
-                default: tkStr += currCh;
+                case 'n' : scanStr += '\n'; break;
+                case '"' : scanStr += '"'; break;
+                case '\\' : scanStr += '\\'; break;
+                default: scanStr += currCh;
                 }
-            } else {
-                tkStr += currCh;
+                getNextCh();
+            } else { // copy everything up to the next escape or quote at once
+                pos = dataPos-2;
+                int end = scan.until(data, pos, dataEnd, '"', '\\');
+                scanStr.append(data+pos, end-pos);
+                scanTo(end);
             }
-            getNextCh();
         }
         getNextCh();
         tk = LEXER_STR;
@@ -500,17 +1260,17 @@ void Lexer::getNextToken() {
             if (currCh == '\\') {
                 getNextCh();
                 switch (currCh) {
-                case 'n' : tkStr += '\n'; break;
-                case 'a' : tkStr += '\a'; break;
-                case 'r' : tkStr += '\r'; break;
-                case 't' : tkStr += '\t'; break;
-                case '\'' : tkStr += '\''; break;
-                case '\\' : tkStr += '\\'; break;
+                case 'n' : scanStr += '\n'; break;
+                case 'a' : scanStr += '\a'; break;
+                case 'r' : scanStr += '\r'; break;
+                case 't' : scanStr += '\t'; break;
+                case '\'' : scanStr += '\''; break;
+                case '\\' : scanStr += '\\'; break;
                 case 'x' : { // hex digits
                               char buf[3] = "??";
                               getNextCh(); buf[0] = currCh;
                               getNextCh(); buf[1] = currCh;
-                              tkStr += (char)strtol(buf,0,16);
+                              scanStr += (char)strtol(buf,0,16);
                            } break;
                 default: if (currCh>='0' && currCh<='7') {
                            // octal digits
@@ -518,14 +1278,17 @@ void Lexer::getNextToken() {
                            buf[0] = currCh;
                            getNextCh(); buf[1] = currCh;
                            getNextCh(); buf[2] = currCh;
-                           tkStr += (char)strtol(buf,0,8);
+                           scanStr += (char)strtol(buf,0,8);
                          } else
-                           tkStr += currCh;
+                           scanStr += currCh;
                 }
-            } else {
-                tkStr += currCh;
+                getNextCh();
+            } else { // copy everything up to the next escape or quote at once
+                pos = dataPos-2;
+                int end = scan.until(data, pos, dataEnd, '\'', '\\');
+                scanStr.append(data+pos, end-pos);
+                scanTo(end);
             }
-            getNextCh();
         }
         getNextCh();
         tk = LEXER_STR;
@@ -605,20 +1368,13 @@ void Lexer::getNextToken() {
 }
 
 std::string Lexer::getSubString(int lastPosition) {
-    int lastCharIdx = tokenLastEnd+1;
-    if (lastCharIdx < dataEnd) {
-        /* save a memory alloc by using our data array to create the
-           substring */
-        char old = data[lastCharIdx];
-        data[lastCharIdx] = 0;
-        std::string value = &data[lastPosition];
-        data[lastCharIdx] = old;
-        return value;
-    } else {
-        return std::string(&data[lastPosition]);
-    }
+    return getSubSource(lastPosition).str();
 }
 
+SourceSlice Lexer::getSubSource(int lastPosition) {
+    int lastCharIdx = tokenLastEnd+1;
+    return SourceSlice(source, lastPosition, lastCharIdx < dataEnd ? lastCharIdx : dataEnd);
+}
 
 Lexer *Lexer::getSubLex(int lastPosition) {
     int lastCharIdx = tokenLastEnd+1;
@@ -630,10 +1386,14 @@ Lexer *Lexer::getSubLex(int lastPosition) {
 
 std::string Lexer::getPosition(int pos) {
     if (pos<0) pos=tokenLastEnd;
+    return source->getPosition(pos);
+}
+
+std::string Lexer::formatPosition(const char *data, int dataLength, int pos) {
     int line = 1,col = 1;
     for (int i=0;i<pos;i++) {
         char ch;
-        if (i < dataEnd)
+        if (i < dataLength)
             ch = data[i];
         else
             ch = 0;
@@ -648,9 +1408,125 @@ std::string Lexer::getPosition(int pos) {
     return buf;
 }
 
+// ----------------------------------------------------------------------------------- NAME
+
+/// Hash table of the interned names of one thread
+class NameTable
+{
+public:
+    NameTable() : buckets(64, (NameData*)0), count(0) {}
+
+    std::vector<NameData*> buckets; ///< Chains of names, a size that is a power of 2
+    int count; ///< Number of names in the table
+    Name thisName, returnName, prototypeName; ///< Names the interpreter looks up itself
+};
+
+/// Made on first use and never freed, like the pools
+static TINYJS_THREAD_LOCAL NameTable *nameTable;
+
+static NameTable *getNameTable() {
+    if (!nameTable) {
+      nameTable = new NameTable();
+      nameTable->thisName = "this";
+      nameTable->returnName = TINYJS_RETURN_VAR;
+      nameTable->prototypeName = TINYJS_PROTOTYPE_CLASS;
+    }
+    return nameTable;
+}
+
+/// Index for Variable::elements of a name (see Name::getElementIndex)
+static int getNameElementIndex(const std::string &name) {
+    if (name.empty() || !isNumber(name)) return name.empty() ? -2 : -1;
+    // only names we'd write back out the same (and that fit in an int) have an index
+    if ((name[0]=='0' && name.size()>1) || name.size()>9) return -2;
+    return atoi(name.c_str());
+}
+
+const std::string Name::blank;
+
+Name &Name::operator=(const Name &name) {
+    if (name.data) name.data->refs++;
+    if (data) release(data);
+    data = name.data;
+    return *this;
+}
+
+unsigned int Name::hashOf(const StringView &str) {
+    // FNV-1a
+    unsigned int h = 2166136261u;
+    for (int i=0;i<str.length;i++) {
+      h ^= (unsigned char)str.data[i];
+      h *= 16777619u;
+    }
+    return h;
+}
+
+const Name &Name::getThis() {
+    return getNameTable()->thisName;
+}
+
+const Name &Name::getReturn() {
+    return getNameTable()->returnName;
+}
+
+const Name &Name::getPrototype() {
+    return getNameTable()->prototypeName;
+}
+
+NameData *Name::intern(const StringView &str) {
+    NameTable *table = getNameTable();
+    unsigned int h = hashOf(str);
+    unsigned int mask = (unsigned int)table->buckets.size()-1;
+    for (NameData *d = table->buckets[h&mask]; d; d = d->next)
+      if (d->hash == h && StringView(d->str) == str) {
+        d->refs++;
+        return d;
+      }
+    if (table->count >= (int)table->buckets.size()) {
+      // rehash into twice as many buckets
+      std::vector<NameData*> old(table->buckets.size()*2, (NameData*)0);
+      old.swap(table->buckets);
+      mask = (unsigned int)table->buckets.size()-1;
+      for (size_t i=0;i<old.size();i++)
+        for (NameData *d = old[i]; d; ) {
+          NameData *next = d->next;
+          d->next = table->buckets[d->hash&mask];
+          table->buckets[d->hash&mask] = d;
+          d = next;
+        }
+    }
+    NameData *data = new NameData();
+    data->refs = 1;
+    data->hash = h;
+    data->str = str.str();
+    data->literal = 0;
+    data->elementIndex = getNameElementIndex(data->str);
+    data->next = table->buckets[h&mask];
+    table->buckets[h&mask] = data;
+    table->count++;
+    return data;
+}
+
+StringData *Name::getLiteral() const {
+    if (!data) return 0;
+    if (!data->literal) data->literal = (new StringData(data->str))->ref();
+    return data->literal;
+}
+
+void Name::release(NameData *data) {
+    if (--data->refs > 0) return;
+    NameTable *table = nameTable;
+    NameData **d = &table->buckets[data->hash & (table->buckets.size()-1)];
+    while (*d != data) d = &(*d)->next;
+    *d = data->next;
+    table->count--;
+    if (data->literal) data->literal->unref();
+    delete data;
+}
+
 // ----------------------------------------------------------------------------------- CSCRIPTVARLINK
 
-VariableLink::VariableLink(Variable *var, const std::string &varName)
+VariableLink::VariableLink(Variable *var, const Name &varName)
     : name(varName) {
 #if DEBUG_MEMORY
     mark_allocated(this);
@@ -681,6 +1557,8 @@ VariableLink::~VariableLink() {
 }
 
 void VariableLink::replaceWith(Variable *newVar) {
+    if (owned && newVar->isImmortal())
+      newVar = newVar->deepCopy(); // constants are never stored
     Variable *oldVar = var;
     var = newVar->ref();
     oldVar->unref();
@@ -693,16 +1571,236 @@ void VariableLink::replaceWith(VariableLink *newVar) {
       replaceWith(new Variable());
 }
 
+void VariableLink::copyIfConstant() {
+    if (var->isImmortal())
+      replaceWith(var->deepCopy());
+}
+
 int VariableLink::getIntName() const {
-    return atoi(name.c_str());
+    return atoi(name.str().c_str());
 }
 
 void VariableLink::setIntName(int n) {
-    char sIdx[64];
-    sprintf_s(sIdx, sizeof(sIdx), "%d", n);
+    char sIdx[TINYJS_NUMBER_BUFFER];
+    formatInteger(sIdx, n);
     name = sIdx;
 }
 
+// ----------------------------------------------------------------------------------- CHILD INDEX
+
+/// Marks an entry of a ChildIndex that was removed, so searches carry on past it
+static char childIndexRemoved;
+#define TINYJS_INDEX_REMOVED (reinterpret_cast<VariableLink*>(&childIndexRemoved))
+
+ChildIndex::ChildIndex() {
+    used = 0;
+    duplicates = false;
+}
+
+int ChildIndex::findEntry(const Name &name) const {
+    if (table.empty()) return -1;
+    unsigned int mask = (unsigned int)table.size()-1;
+    for (unsigned int i = name.getHash()&mask; table[i]; i = (i+1)&mask)
+      if (table[i] != TINYJS_INDEX_REMOVED && table[i]->name == name)
+        return (int)i;
+    return -1;
+}
+
+VariableLink *ChildIndex::find(const Name &name) const {
+    int entry = findEntry(name);
+    return entry<0 ? 0 : table[entry];
+}
+
+void ChildIndex::insert(VariableLink *link) {
+    if ((used+1)*2 > (int)table.size()) {
+      // rebuild, leaving out removed entries
+      std::vector<VariableLink*> old;
+      old.swap(table);
+      int size = 16;
+      while (size < (used+1)*4) size *= 2;
+      table.resize(size, 0);
+      used = 0;
+      for (size_t i=0;i<old.size();i++)
+        if (old[i] && old[i] != TINYJS_INDEX_REMOVED)
+          insert(old[i]);
+    }
+    unsigned int mask = (unsigned int)table.size()-1;
+    unsigned int i = link->name.getHash()&mask;
+    while (table[i] && table[i] != TINYJS_INDEX_REMOVED) i = (i+1)&mask;
+    if (!table[i]) used++;
+    table[i] = link;
+}
+
+void ChildIndex::add(VariableLink *link) {
+    // it is at the end of the list, so any child with the same name comes first
+    if (find(link->name)) {
+      duplicates = true;
+      return;
+    }
+    insert(link);
+}
+
+void ChildIndex::addRenamed(VariableLink *link) {
+    int entry = findEntry(link->name);
+    if (entry<0) {
+      insert(link);
+      return;
+    }
+    duplicates = true;
+    // the link that comes first in the list wins
+    for (VariableLink *v = link->nextSibling; v; v = v->nextSibling)
+      if (v == table[entry]) {
+        table[entry] = link;
+        return;
+      }
+}
+
+size_t ChildIndex::getMemoryUsed() const {
+    return sizeof(ChildIndex) + table.capacity()*sizeof(VariableLink*);
+}
+
+void ChildIndex::remove(VariableLink *link) {
+    int entry = findEntry(link->name);
+    if (entry<0 || table[entry] != link) return;
+    table[entry] = TINYJS_INDEX_REMOVED;
+    if (duplicates) {
+      // index the next child with this name instead
+      for (VariableLink *v = link->nextSibling; v; v = v->nextSibling)
+        if (v->name == link->name) {
+          insert(v);
+          break;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------- SHAPE
+
+Shape::Shape(Shape *parent, const Name &name)
+    : name(name) {
+    this->parent = parent;
+    count = parent ? parent->count+1 : 0;
+    refs = 0;
+    if (parent) parent->ref();
+}
+
+Shape::~Shape() {
+    ASSERT(transitions.empty());
+}
+
+/// The root of this thread's shape tree. Like the name table its shapes' Names
+/// come from, it's per-thread, made on first use and never freed.
+static TINYJS_THREAD_LOCAL Shape *emptyShape;
+
+Shape *Shape::getEmpty() {
+    // never deleted, as it's always referenced
+    if (!emptyShape) emptyShape = (new Shape(0, Name()))->ref();
+    return emptyShape;
+}
+
+Shape *Shape::addProperty(const Name &name) {
+    std::map<Name, Shape*>::iterator it = transitions.find(name);
+    if (it != transitions.end()) return it->second;
+    Shape *shape = new Shape(this, name);
+    transitions[name] = shape;
+    return shape;
+}
+
+Shape *Shape::ref() {
+    refs++;
+    return this;
+}
+
+void Shape::unref() {
+    if (--refs == 0) {
+      if (parent) {
+        parent->transitions.erase(name);
+        parent->unref();
+      }
+      delete this;
+    }
+}
+
+// ----------------------------------------------------------------------------------- STRING DATA
+
+/// Bytes a string uses on the heap (short ones fit in the std::string itself)
+static size_t getStringMemoryUsed(const std::string &str) {
+    return str.capacity() < sizeof(std::string) ? 0 : str.capacity()+1;
+}
+
+StringData::StringData() : length(0), refs(0), left(0), right(0) {
+}
+
+StringData::StringData(const std::string &str) : length((int)str.size()), refs(0), flat(str), left(0), right(0) {
+}
+
+StringData *StringData::join(StringData *left, StringData *right) {
+    StringData *s = new StringData();
+    s->left = left->ref();
+    s->right = right->ref();
+    s->length = left->length + right->length;
+    return s;
+}
+
+const std::string &StringData::str() {
+    if (left) flatten();
+    return flat;
+}
+
+void StringData::flatten() {
+    std::string chars;
+    chars.reserve(length);
+    // ropes are usually deep down one side, so walk them without recursing
+    std::vector<StringData*> stack;
+    stack.push_back(this);
+    while (!stack.empty()) {
+      StringData *s = stack.back();
+      stack.pop_back();
+      if (s->left) {
+        stack.push_back(s->right);
+        stack.push_back(s->left);
+      } else
+        chars += s->flat;
+    }
+    flat.swap(chars);
+    StringData *l = left, *r = right;
+    left = right = 0;
+    l->unref();
+    r->unref();
+}
+
+void StringData::setFlat(const std::string &str) {
+    flat = str;
+    length = (int)str.size();
+}
+
+StringData *StringData::ref() {
+    refs++;
+    return this;
+}
+
+void StringData::unref() {
+    if ((--refs) > 0) return;
+    if (!left) {
+      delete this;
+      return;
+    }
+    // free the rope without recursing, as it could be very deep
+    std::vector<StringData*> unused(1, this);
+    while (!unused.empty()) {
+      StringData *s = unused.back();
+      unused.pop_back();
+      if (s->left) {
+        if ((--s->left->refs)==0) unused.push_back(s->left);
+        if ((--s->right->refs)==0) unused.push_back(s->right);
+      }
+      delete s;
+    }
+}
+
+size_t StringData::getMemoryUsed() const {
+    return sizeof(StringData) + getStringMemoryUsed(flat);
+}
+
 // ----------------------------------------------------------------------------------- VARIABLE
 
 Variable::Variable() {
@@ -711,7 +1809,6 @@ Variable::Variable() {
     mark_allocated(this);
 #endif
     init();
-    flags = VARIABLE_UNDEFINED;
 }
 
 Variable::Variable(const std::string &str) {
@@ -720,8 +1817,8 @@ Variable::Variable(const std::string &str) {
     mark_allocated(this);
 #endif
     init();
-    flags = VARIABLE_STRING;
-    stringData = str;
+    setFlags(VARIABLE_STRING);
+    setStringData(str);
 }
 
 
@@ -731,13 +1828,18 @@ Variable::Variable(const std::string &varData, int varFlags) {
     mark_allocated(this);
 #endif
     init();
-    flags = varFlags;
+    setFlags(varFlags);
     if (varFlags & VARIABLE_INTEGER) {
-      intData = strtol(varData.c_str(),0,0);
+      intData = parseInteger(varData.c_str());
     } else if (varFlags & VARIABLE_DOUBLE) {
-      doubleData = strtod(varData.c_str(),0);
+      doubleData = parseNumber(varData.c_str());
+    } else if (varFlags & VARIABLE_FUNCTION) {
+      if (!varData.empty()) {
+        Source *source = new Source(varData);
+        functionData->code = SourceSlice(source, 0, source->length);
+      }
     } else
-    stringData = varData;
+      setStringData(varData);
 }
 
 Variable::Variable(double val) {
@@ -758,6 +1860,15 @@ Variable::Variable(int val) {
     setInt(val);
 }
 
+Variable::Variable(const NumericValue &val) {
+    refs = 0;
+#if DEBUG_MEMORY
+    mark_allocated(this);
+#endif
+    init();
+    setNumeric(val);
+}
+
 Variable::Variable(const std::vector<unsigned char> &val) {
     refs = 0;
 #if DEBUG_MEMORY
@@ -772,43 +1883,118 @@ Variable::~Variable(void) {
     mark_deallocated(this);
 #endif
     removeAllChildren();
+    setFlags(VARIABLE_UNDEFINED); // frees the value
+}
+
+/// The immortal constants of one thread (see Variable::getIntValue)
+class ConstantTable
+{
+public:
+    ConstantTable();
+
+    Variable *undefinedValue, *nullValue;
+    Variable *ints[TINYJS_SMALL_INT_MAX-TINYJS_SMALL_INT_MIN+1]; ///< From TINYJS_SMALL_INT_MIN
+};
+
+ConstantTable::ConstantTable() {
+    // each keeps a reference to itself, so it is never freed
+    undefinedValue = (new Variable(TINYJS_BLANK_DATA, VARIABLE_UNDEFINED|VARIABLE_IMMORTAL))->ref();
+    nullValue = (new Variable(TINYJS_BLANK_DATA, VARIABLE_NULL|VARIABLE_IMMORTAL))->ref();
+    for (int i=TINYJS_SMALL_INT_MIN;i<=TINYJS_SMALL_INT_MAX;i++) {
+      Variable *var = new Variable(TINYJS_BLANK_DATA, VARIABLE_INTEGER|VARIABLE_IMMORTAL);
+      var->setInt(i);
+      ints[i-TINYJS_SMALL_INT_MIN] = var->ref();
+    }
+}
+
+/// Made on first use and never freed, like the pools
+static TINYJS_THREAD_LOCAL ConstantTable *constantTable;
+
+static ConstantTable *getConstantTable() {
+    if (!constantTable) constantTable = new ConstantTable();
+    return constantTable;
+}
+
+Variable *Variable::getUndefinedValue() {
+    return getConstantTable()->undefinedValue;
+}
+
+Variable *Variable::getNullValue() {
+    return getConstantTable()->nullValue;
+}
+
+Variable *Variable::getIntValue(long value) {
+    if (value<TINYJS_SMALL_INT_MIN || value>TINYJS_SMALL_INT_MAX) {
+      Variable *var = new Variable(TINYJS_BLANK_DATA, VARIABLE_INTEGER);
+      var->intData = value; // all of it, as Variable(int) would cut it to 32 bits
+      return var;
+    }
+    return getConstantTable()->ints[value-TINYJS_SMALL_INT_MIN];
 }
 
 void Variable::init() {
     firstChild = 0;
-    lastChild = 0;
-    flags = 0;
-    jsCallback = 0;
-    jsCallbackUserData = 0;
-    stringData = TINYJS_BLANK_DATA;
-    intData = 0;
-    doubleData = 0;
+    children = 0;
+    flags = VARIABLE_UNDEFINED;
+    stringData = 0;
+}
+
+void Variable::setFlags(int newFlags) {
+    if (isFunction()) {
+      if (functionData->compiled) functionData->compiled->unref();
+      delete functionData;
+    } else if (!isInt() && !isDouble() && stringData)
+      stringData->unref();
+    flags = newFlags;
+    if (isFunction())
+      functionData = new FunctionData();
+    else if (isInt())
+      intData = 0;
+    else if (isDouble())
+      doubleData = 0;
+    else
+      stringData = 0;
+}
+
+void Variable::setStringData(const std::string &str) {
+    if (stringData && !stringData->isShared() && !stringData->isRope() && !str.empty()) {
+      stringData->setFlat(str); // reuse the buffer
+      return;
+    }
+    if (stringData) stringData->unref();
+    stringData = str.empty() ? 0 : (new StringData(str))->ref();
 }
 
 Variable *Variable::getReturnVar() {
-    return getParameter(TINYJS_RETURN_VAR);
+    return getParameter(Name::getReturn());
 }
 
 void Variable::setReturnVar(Variable *var) {
-    findChildOrCreate(TINYJS_RETURN_VAR)->replaceWith(var);
+    findChildOrCreate(Name::getReturn())->replaceWith(var);
 }
 
 
-Variable *Variable::getParameter(const std::string &name) {
+Variable *Variable::getParameter(const Name &name) {
     return findChildOrCreate(name)->var;
 }
 
-VariableLink *Variable::findChild(const std::string &childName) const {
+VariableLink *Variable::findChild(const Name &childName) const {
+    if (!children) return 0;
+    if (!children->sparse) {
+      int idx = childName.getElementIndex();
+      if (idx>=0) return getElement(idx);
+    }
+    if (children->index) return children->index->find(childName);
     VariableLink *v = firstChild;
     while (v) {
-        if (v->name.compare(childName)==0)
+        if (v->name == childName)
             return v;
         v = v->nextSibling;
     }
     return 0;
 }
 
-VariableLink *Variable::findChildOrCreate(const std::string &childName, int varFlags) {
+VariableLink *Variable::findChildOrCreate(const Name &childName, int varFlags) {
     VariableLink *l = findChild(childName);
     if (l) return l;
 
@@ -824,28 +2010,54 @@ VariableLink *Variable::findChildOrCreateByPath(const std::string &path) {
             findChildOrCreateByPath(path.substr(p+1));
 }
 
-VariableLink *Variable::addChild(const std::string &childName, Variable *child) {
+VariableLink *Variable::addChild(const Name &childName, Variable *child) {
+  ASSERT(!isImmortal()); // constants are only held by temporaries, which copy them first (see VariableLink::copyIfConstant)
   if (isUndefined()) {
-    flags = VARIABLE_OBJECT;
+    setFlags(VARIABLE_OBJECT);
   }
     // if no child supplied, create one
     if (!child)
       child = new Variable();
+    else if (child->isImmortal())
+      child = child->deepCopy(); // constants are never stored
 
     VariableLink *link = new VariableLink(child, childName);
     link->owned = true;
-    if (lastChild) {
-        lastChild->nextSibling = link;
-        link->prevSibling = lastChild;
-        lastChild = link;
+    if (!children) children = new ChildList();
+    // objects start off with a shape, and keep it while properties are only added
+    if (!firstChild && isObject() && !children->shape)
+      children->shape = Shape::getEmpty()->ref();
+    if (children->shape) {
+      if (children->shape->getCount() < TINYJS_SHAPE_MAX_PROPERTIES) {
+        Shape *newShape = children->shape->addProperty(childName)->ref();
+        children->shape->unref();
+        children->shape = newShape;
+        children->slots.push_back(link);
+      } else
+        dropShape();
+    }
+    if (children->lastChild) {
+        children->lastChild->nextSibling = link;
+        link->prevSibling = children->lastChild;
+        children->lastChild = link;
     } else {
         firstChild = link;
-        lastChild = link;
+        children->lastChild = link;
+    }
+    children->count++;
+    if (!children->sparse) addElement(link);
+    if (children->index) {
+      children->index->add(link);
+    } else if (children->count > TINYJS_DICTIONARY_THRESHOLD) {
+      // too many children to search through - switch to a hash index
+      children->index = new ChildIndex();
+      for (VariableLink *v = firstChild; v; v = v->nextSibling)
+        children->index->add(v);
     }
     return link;
 }
 
-VariableLink *Variable::addChildNoDup(const std::string &childName, Variable *child) {
+VariableLink *Variable::addChildNoDup(const Name &childName, Variable *child) {
     // if no child supplied, create one
     if (!child)
       child = new Variable();
@@ -873,18 +2085,27 @@ void Variable::removeChild(Variable *child) {
 
 void Variable::removeLink(VariableLink *link) {
     if (!link) return;
+    dropShape();
+    if (children->index) children->index->remove(link);
+    removeElement(link);
+    children->count--;
     if (link->nextSibling)
       link->nextSibling->prevSibling = link->prevSibling;
     if (link->prevSibling)
       link->prevSibling->nextSibling = link->nextSibling;
-    if (lastChild == link)
-        lastChild = link->prevSibling;
+    if (children->lastChild == link)
+        children->lastChild = link->prevSibling;
     if (firstChild == link)
         firstChild = link->nextSibling;
     delete link;
 }
 
 void Variable::removeAllChildren() {
+    if (!children) return;
+    dropShape();
+    delete children->index;
+    delete children;
+    children = 0;
     VariableLink *c = firstChild;
     while (c) {
         VariableLink *t = c->nextSibling;
@@ -892,21 +2113,82 @@ void Variable::removeAllChildren() {
         c = t;
     }
     firstChild = 0;
-    lastChild = 0;
+}
+
+void Variable::renameChild(VariableLink *link, const Name &newName) {
+    dropShape();
+    if (children->index) children->index->remove(link);
+    removeElement(link);
+    link->name = newName;
+    if (children->index) children->index->addRenamed(link);
+    if (!children->sparse) addElement(link);
+}
+
+void Variable::dropShape() {
+    if (!children || !children->shape) return;
+    children->shape->unref();
+    children->shape = 0;
+    std::vector<VariableLink*>().swap(children->slots);
+}
+
+void Variable::addElement(VariableLink *link) {
+    int idx = link->name.getElementIndex();
+    if (idx==-1) return;
+    std::vector<VariableLink*> &elements = children->elements;
+    int size = (int)elements.size();
+    if (idx<0 || (idx<size && elements[idx]) || idx > size*2 + TINYJS_ARRAY_SPARSE_GAP) {
+      makeSparse();
+      return;
+    }
+    if (idx>=size) elements.resize(idx+1, 0);
+    elements[idx] = link;
+}
+
+void Variable::removeElement(VariableLink *link) {
+    if (children->sparse) return;
+    int idx = link->name.getElementIndex();
+    std::vector<VariableLink*> &elements = children->elements;
+    if (idx<0 || idx>=(int)elements.size() || elements[idx]!=link) return;
+    elements[idx] = 0;
+    // keep the last element non-empty, so the size is the array's length
+    while (!elements.empty() && !elements.back())
+      elements.pop_back();
+}
+
+void Variable::makeSparse() {
+    children->sparse = true;
+    std::vector<VariableLink*>().swap(children->elements);
+}
+
+VariableLink *Variable::getElement(const Variable *idx) const {
+    // anything but an int in range has to be looked up by name
+    if (!children || !idx->isInt() || idx->intData<0 || idx->intData>=(long)children->elements.size()) return 0;
+    return getElement((int)idx->intData);
 }
 
 Variable *Variable::getArrayIndex(int idx) const {
-    char sIdx[64];
-    sprintf_s(sIdx, sizeof(sIdx), "%d", idx);
-    VariableLink *link = findChild(sIdx);
+    VariableLink *link;
+    if (!(children && children->sparse) && idx>=0) {
+      link = getElement(idx);
+    } else {
+      char sIdx[TINYJS_NUMBER_BUFFER];
+      formatInteger(sIdx, idx);
+      link = findChild(sIdx);
+    }
     if (link) return link->var;
-    else return new Variable(TINYJS_BLANK_DATA, VARIABLE_NULL); // undefined
+    else return getNullValue(); // undefined
 }
 
 void Variable::setArrayIndex(int idx, Variable *value) {
-    char sIdx[64];
-    sprintf_s(sIdx, sizeof(sIdx), "%d", idx);
-    VariableLink *link = findChild(sIdx);
+    char sIdx[TINYJS_NUMBER_BUFFER];
+    sIdx[0] = 0; // only needed to find or add the element by name
+    VariableLink *link;
+    if (!(children && children->sparse) && idx>=0) {
+      link = getElement(idx);
+    } else {
+      formatInteger(sIdx, idx);
+      link = findChild(sIdx);
+    }
 
     if (link) {
       if (value->isUndefined())
@@ -914,19 +2196,23 @@ void Variable::setArrayIndex(int idx, Variable *value) {
       else
         link->replaceWith(value);
     } else {
-      if (!value->isUndefined())
+      if (!value->isUndefined()) {
+        if (!sIdx[0]) formatInteger(sIdx, idx);
         addChild(sIdx, value);
+      }
     }
 }
 
 int Variable::getArrayLength() const {
     int highest = -1;
     if (!isArray()) return 0;
+    if (!children) return 0;
+    if (!children->sparse) return (int)children->elements.size();
 
     VariableLink *link = firstChild;
     while (link) {
       if (isNumber(link->name)) {
-        int val = atoi(link->name.c_str());
+        int val = link->getIntName();
         if (val > highest) highest = val;
       }
       link = link->nextSibling;
@@ -935,13 +2221,7 @@ int Variable::getArrayLength() const {
 }
 
 int Variable::getChildren() const {
-    int n = 0;
-    VariableLink *link = firstChild;
-    while (link) {
-      n++;
-      link = link->nextSibling;
-    }
-    return n;
+    return children ? children->count : 0;
 }
 
 const std::vector<unsigned char> Variable::getArray() const {
@@ -980,67 +2260,73 @@ const std::string Variable::getString() const {
     static std::string s_null = "null";
     static std::string s_undefined = "undefined";
     if (isInt()) {
-      char buffer[32];
-      sprintf_s(buffer, sizeof(buffer), "%ld", intData);
-      return buffer;
+      char buffer[TINYJS_NUMBER_BUFFER];
+      return std::string(buffer, formatInteger(buffer, intData));
     }
     if (isDouble()) {
-      char buffer[32];
-      sprintf_s(buffer, sizeof(buffer), "%f", doubleData);
-      return buffer;
+      char buffer[TINYJS_NUMBER_BUFFER];
+      return std::string(buffer, formatNumber(buffer, doubleData));
     }
     if (isNull()) return s_null;
     if (isUndefined()) return s_undefined;
+    if (isFunction()) return functionData->code.str();
     // are we just a string here?
-    return stringData;
+    return stringData ? stringData->str() : TINYJS_BLANK_DATA;
+}
+
+StringView Variable::getStringView(char *buffer) const {
+    if (isInt()) return StringView(buffer, formatInteger(buffer, intData));
+    if (isDouble()) return StringView(buffer, formatNumber(buffer, doubleData));
+    if (isNull()) return StringView("null", 4);
+    if (isUndefined()) return StringView("undefined", 9);
+    if (isFunction()) return functionData->code.view();
+    return stringData ? StringView(stringData->str()) : StringView();
+}
+
+int Variable::getStringLength() const {
+    if (isString()) return stringData ? stringData->length : 0;
+    return (int)getString().size();
 }
 
 void Variable::setInt(int val) {
-    flags = (flags&~VARIABLE_TYPEMASK) | VARIABLE_INTEGER;
+    if (!isInt()) setFlags((flags&~VARIABLE_TYPEMASK) | VARIABLE_INTEGER);
     intData = val;
-    doubleData = 0;
-    stringData = TINYJS_BLANK_DATA;
 }
 
 void Variable::setDouble(double val) {
-    flags = (flags&~VARIABLE_TYPEMASK) | VARIABLE_DOUBLE;
+    if (!isDouble()) setFlags((flags&~VARIABLE_TYPEMASK) | VARIABLE_DOUBLE);
     doubleData = val;
-    intData = 0;
-    stringData = TINYJS_BLANK_DATA;
 }
 
 void Variable::setString(const std::string &str) {
     // name sure it's not still a number or integer
-    flags = (flags&~VARIABLE_TYPEMASK) | VARIABLE_STRING;
-    stringData = str;
-    intData = 0;
-    doubleData = 0;
+    if (!isString()) setFlags((flags&~VARIABLE_TYPEMASK) | VARIABLE_STRING);
+    setStringData(str);
+}
+
+void Variable::setStringLiteral(const Name &str) {
+    if (!isString()) setFlags((flags&~VARIABLE_TYPEMASK) | VARIABLE_STRING);
+    StringData *literal = str.getLiteral();
+    if (literal) literal->ref();
+    if (stringData) stringData->unref();
+    stringData = literal;
 }
 
 void Variable::setUndefined() {
     // name sure it's not still a number or integer
-    flags = (flags&~VARIABLE_TYPEMASK) | VARIABLE_UNDEFINED;
-    stringData = TINYJS_BLANK_DATA;
-    intData = 0;
-    doubleData = 0;
+    setFlags((flags&~VARIABLE_TYPEMASK) | VARIABLE_UNDEFINED);
     removeAllChildren();
 }
 
 void Variable::setArray() {
     // name sure it's not still a number or integer
-    flags = (flags&~VARIABLE_TYPEMASK) | VARIABLE_ARRAY;
-    stringData = TINYJS_BLANK_DATA;
-    intData = 0;
-    doubleData = 0;
+    setFlags((flags&~VARIABLE_TYPEMASK) | VARIABLE_ARRAY);
     removeAllChildren();
 }
 
 void Variable::setArray(const std::vector<unsigned char> &val) {
     // name sure it's not still a number or integer
-    flags = (flags&~VARIABLE_TYPEMASK) | VARIABLE_ARRAY;
-    stringData = TINYJS_BLANK_DATA;
-    intData = 0;
-    doubleData = 0;
+    setFlags((flags&~VARIABLE_TYPEMASK) | VARIABLE_ARRAY);
     removeAllChildren();
     for (std::vector<unsigned char>::size_type i = 0; i < val.size(); ++i) {
         setArrayIndex(i, new TinyJS::Variable(static_cast<int>(val[i])));
@@ -1048,12 +2334,111 @@ void Variable::setArray(const std::vector<unsigned char> &val) {
 }
 
 bool Variable::equals(const Variable *v) {
+    NumericValue va, vb, eql;
+    if (getNumeric(va) && v->getNumeric(vb)) {
+      NumericValue::maths(va, vb, LEXER_EQUAL, eql);
+      return eql.intData!=0;
+    }
     Variable *resV = mathsOp(v, LEXER_EQUAL);
     bool res = resV->getBool();
-    delete resV;
+    if (!resV->refs) delete resV;
     return res;
 }
 
+void NumericValue::maths(const NumericValue &a, const NumericValue &b, int op, NumericValue &result) {
+    // result may be a or b, so they're read before it is written to
+    if (!a.isDouble && !b.isDouble) {
+        // use ints
+        int da = a.intData;
+        int db = b.intData;
+        result.isDouble = false;
+        switch (op) {
+            case '+': result.intData = da+db; return;
+            case '-': result.intData = da-db; return;
+            case '*': result.intData = da*db; return;
+            case '/': result.intData = da/db; return;
+            case '&': result.intData = da&db; return;
+            case '|': result.intData = da|db; return;
+            case '^': result.intData = da^db; return;
+            case '%': result.intData = da%db; return;
+            case LEXER_EQUAL:     result.intData = da==db; return;
+            case LEXER_NEQUAL:    result.intData = da!=db; return;
+            case '<':     result.intData = da<db; return;
+            case LEXER_LEQUAL:    result.intData = da<=db; return;
+            case '>':     result.intData = da>db; return;
+            case LEXER_GEQUAL:    result.intData = da>=db; return;
+            default: throw new Exception("Operation "+Lexer::getTokenStr(op)+" not supported on the Int datatype");
+        }
+    } else {
+        // use doubles
+        double da = a.isDouble ? a.doubleData : a.intData;
+        double db = b.isDouble ? b.doubleData : b.intData;
+        result.isDouble = true;
+        switch (op) {
+            case '+': result.doubleData = da+db; return;
+            case '-': result.doubleData = da-db; return;
+            case '*': result.doubleData = da*db; return;
+            case '/': result.doubleData = da/db; return;
+        }
+        // comparisons give ints
+        result.isDouble = false;
+        switch (op) {
+            case LEXER_EQUAL:     result.intData = da==db; return;
+            case LEXER_NEQUAL:    result.intData = da!=db; return;
+            case '<':     result.intData = da<db; return;
+            case LEXER_LEQUAL:    result.intData = da<=db; return;
+            case '>':     result.intData = da>db; return;
+            case LEXER_GEQUAL:    result.intData = da>=db; return;
+            default: throw new Exception("Operation "+Lexer::getTokenStr(op)+" not supported on the Double datatype");
+        }
+    }
+}
+
+bool Variable::getNumeric(NumericValue &val) const {
+    if (!isNumeric()) return false;
+    val.isDouble = isDouble();
+    if (val.isDouble)
+      val.doubleData = doubleData;
+    else
+      val.intData = getInt();
+    return true;
+}
+
+void Variable::setNumeric(const NumericValue &val) {
+    if (val.isDouble)
+      setDouble(val.doubleData);
+    else
+      setInt(val.intData);
+}
+
+bool Variable::mathsOpInPlace(const Variable *b, int op) {
+    NumericValue vb;
+    return b->getNumeric(vb) && mathsOpInPlace(vb, op);
+}
+
+bool Variable::mathsOpInPlace(const NumericValue &b, int op) {
+    // if anything else holds this variable, it has to see the old value
+    NumericValue va;
+    if (refs>1 || !isBasic() || !getNumeric(va)) return false;
+    NumericValue::maths(va, b, op, va);
+    setNumeric(va);
+    return true;
+}
+
+Variable *Variable::unaryOp(int op) {
+    NumericValue va, res;
+    if (getNumeric(va)) {
+      if (op=='!')
+        NumericValue::maths(va, NumericValue(0), LEXER_EQUAL, res);
+      else
+        NumericValue::maths(NumericValue(0), va, '-', res);
+      return new Variable(res);
+    }
+    Variable zero(0);
+    if (op=='!') return mathsOp(&zero, LEXER_EQUAL);
+    return zero.mathsOp(this, '-');
+}
+
 Variable *Variable::mathsOp(const Variable *b, int op) {
     Variable *a = this;
     // Type equality check
@@ -1067,82 +2452,66 @@ Variable *Variable::mathsOp(const Variable *b, int op) {
         if (!contents->refs) delete contents;
       }
       if (op == LEXER_TYPEEQUAL)
-        return new Variable(eql);
+        return getBoolValue(eql);
       else
-        return new Variable(!eql);
+        return getBoolValue(!eql);
     }
     // do maths...
     if (a->isUndefined() && b->isUndefined()) {
-      if (op == LEXER_EQUAL) return new Variable(true);
-      else if (op == LEXER_NEQUAL) return new Variable(false);
-      else return new Variable(); // undefined
+      if (op == LEXER_EQUAL) return getBoolValue(true);
+      else if (op == LEXER_NEQUAL) return getBoolValue(false);
+      else return getUndefinedValue();
     } else if ((a->isNumeric() || a->isUndefined()) &&
                (b->isNumeric() || b->isUndefined())) {
-        if (!a->isDouble() && !b->isDouble()) {
-            // use ints
-            int da = a->getInt();
-            int db = b->getInt();
-            switch (op) {
-                case '+': return new Variable(da+db);
-                case '-': return new Variable(da-db);
-                case '*': return new Variable(da*db);
-                case '/': return new Variable(da/db);
-                case '&': return new Variable(da&db);
-                case '|': return new Variable(da|db);
-                case '^': return new Variable(da^db);
-                case '%': return new Variable(da%db);
-                case LEXER_EQUAL:     return new Variable(da==db);
-                case LEXER_NEQUAL:    return new Variable(da!=db);
-                case '<':     return new Variable(da<db);
-                case LEXER_LEQUAL:    return new Variable(da<=db);
-                case '>':     return new Variable(da>db);
-                case LEXER_GEQUAL:    return new Variable(da>=db);
-                default: throw new Exception("Operation "+Lexer::getTokenStr(op)+" not supported on the Int datatype");
-            }
-        } else {
-            // use doubles
-            double da = a->getDouble();
-            double db = b->getDouble();
-            switch (op) {
-                case '+': return new Variable(da+db);
-                case '-': return new Variable(da-db);
-                case '*': return new Variable(da*db);
-                case '/': return new Variable(da/db);
-                case LEXER_EQUAL:     return new Variable(da==db);
-                case LEXER_NEQUAL:    return new Variable(da!=db);
-                case '<':     return new Variable(da<db);
-                case LEXER_LEQUAL:    return new Variable(da<=db);
-                case '>':     return new Variable(da>db);
-                case LEXER_GEQUAL:    return new Variable(da>=db);
-                default: throw new Exception("Operation "+Lexer::getTokenStr(op)+" not supported on the Double datatype");
-            }
-        }
+        NumericValue va, vb, res;
+        // undefined is treated as 0
+        a->getNumeric(va);
+        b->getNumeric(vb);
+        NumericValue::maths(va, vb, op, res);
+        return new Variable(res);
     } else if (a->isArray()) {
       /* Just check pointers */
       switch (op) {
-           case LEXER_EQUAL: return new Variable(a==b);
-           case LEXER_NEQUAL: return new Variable(a!=b);
+           case LEXER_EQUAL: return getBoolValue(a==b);
+           case LEXER_NEQUAL: return getBoolValue(a!=b);
            default: throw new Exception("Operation "+Lexer::getTokenStr(op)+" not supported on the Array datatype");
       }
     } else if (a->isObject()) {
           /* Just check pointers */
           switch (op) {
-               case LEXER_EQUAL: return new Variable(a==b);
-               case LEXER_NEQUAL: return new Variable(a!=b);
+               case LEXER_EQUAL: return getBoolValue(a==b);
+               case LEXER_NEQUAL: return getBoolValue(a!=b);
                default: throw new Exception("Operation "+Lexer::getTokenStr(op)+" not supported on the Object datatype");
           }
     } else {
-       std::string da = a->getString();
-       std::string db = b->getString();
+       int lengthA = a->getStringLength(), lengthB = b->getStringLength();
+       if (op=='+' && lengthA && lengthB && lengthA + lengthB >= TINYJS_ROPE_MIN_LENGTH) {
+         // don't copy long strings, just join them in a rope
+         Variable *joined = new Variable(TINYJS_BLANK_DATA, VARIABLE_STRING);
+         StringData *left = a->isString() && a->stringData ? a->stringData->ref() : (new StringData(a->getString()))->ref();
+         StringData *right = b->isString() && b->stringData ? b->stringData->ref() : (new StringData(b->getString()))->ref();
+         joined->stringData = StringData::join(left, right)->ref();
+         left->unref();
+         right->unref();
+         return joined;
+       }
+       char bufferA[TINYJS_NUMBER_BUFFER], bufferB[TINYJS_NUMBER_BUFFER];
+       StringView da = a->getStringView(bufferA);
+       StringView db = b->getStringView(bufferB);
        // use strings
        switch (op) {
-           case '+':           return new Variable(da+db, VARIABLE_STRING);
-           case LEXER_EQUAL:     return new Variable(da==db);
-           case LEXER_NEQUAL:    return new Variable(da!=db);
-           case '<':     return new Variable(da<db);
-           case LEXER_LEQUAL:    return new Variable(da<=db);
-           case '>':     return new Variable(da>db);
-           case LEXER_GEQUAL:    return new Variable(da>=db);
+           case '+': {
+             std::string joined;
+             joined.reserve(da.length + db.length);
+             joined.append(da.data, da.length).append(db.data, db.length);
+             return new Variable(joined, VARIABLE_STRING);
+           }
+           case LEXER_EQUAL:     return getBoolValue(da==db);
+           case LEXER_NEQUAL:    return getBoolValue(da!=db);
+           case '<':     return getBoolValue(da.compare(db)<0);
+           case LEXER_LEQUAL:    return getBoolValue(da.compare(db)<=0);
+           case '>':     return getBoolValue(da.compare(db)>0);
+           case LEXER_GEQUAL:    return getBoolValue(da.compare(db)>=0);
            default: throw new Exception("Operation "+Lexer::getTokenStr(op)+" not supported on the string datatype");
        }
     }
@@ -1151,10 +2520,24 @@ Variable *Variable::mathsOp(const Variable *b, int op) {
 }
 
 void Variable::copySimpleData(const Variable *val) {
-    stringData = val->stringData;
-    intData = val->intData;
-    doubleData = val->doubleData;
-    flags = (flags & ~VARIABLE_TYPEMASK) | (val->flags & VARIABLE_TYPEMASK);
+    if (val == this) return;
+    int newFlags = (flags & ~VARIABLE_TYPEMASK) | (val->flags & VARIABLE_TYPEMASK);
+    if (newFlags != flags) setFlags(newFlags);
+    if (isFunction()) {
+      // share the parsed body of functions
+      if (val->functionData->compiled) val->functionData->compiled->ref();
+      if (functionData->compiled) functionData->compiled->unref();
+      *functionData = *val->functionData;
+    } else if (isInt())
+      intData = val->intData;
+    else if (isDouble())
+      doubleData = val->doubleData;
+    else {
+      // strings never change once made, so they can be shared
+      if (val->stringData) val->stringData->ref();
+      if (stringData) stringData->unref();
+      stringData = val->stringData;
+    }
 }
 
 void Variable::copyValue(const Variable *val) {
@@ -1167,7 +2550,7 @@ void Variable::copyValue(const Variable *val) {
       while (child) {
         Variable *copied;
         // don't copy the 'parent' object...
-        if (child->name != TINYJS_PROTOTYPE_CLASS)
+        if (child->name != Name::getPrototype())
           copied = child->var->deepCopy();
         else
           copied = child->var;
@@ -1189,7 +2572,7 @@ Variable *Variable::deepCopy() const {
     while (child) {
         Variable *copied;
         // don't copy the 'parent' object...
-        if (child->name != TINYJS_PROTOTYPE_CLASS)
+        if (child->name != Name::getPrototype())
           copied = child->var->deepCopy();
         else
           copied = child->var;
@@ -1236,7 +2619,7 @@ std::string Variable::getParsableString() const {
     // get list of parameters
     VariableLink *link = firstChild;
     while (link) {
-      funcStr << link->name;
+      funcStr << link->name.str();
       if (link->nextSibling) funcStr << ",";
       link = link->nextSibling;
     }
@@ -1289,8 +2672,30 @@ void Variable::getJSON(std::ostringstream &destination, const std::string &lineP
 
 
 void Variable::setCallback(JSCallback callback, void *userdata) {
-    jsCallback = callback;
-    jsCallbackUserData = userdata;
+    ASSERT(isFunction());
+    functionData->jsCallback = callback;
+    functionData->jsCallbackUserData = userdata;
+}
+
+void Variable::setCallback(JSNativeCallback callback, void *userdata) {
+    ASSERT(isFunction());
+    functionData->jsNativeCallback = callback;
+    functionData->jsCallbackUserData = userdata;
+}
+
+size_t Variable::getMemoryUsed() const {
+    size_t bytes = sizeof(Variable);
+    if (isFunction())
+      bytes += sizeof(FunctionData); // the source of the body is shared
+    else if (!isInt() && !isDouble() && stringData)
+      bytes += stringData->getMemoryUsed();
+    if (children) {
+      // names are shared, so they aren't counted
+      bytes += sizeof(ChildList) + children->count*sizeof(VariableLink) +
+               (children->slots.capacity() + children->elements.capacity())*sizeof(VariableLink*);
+      if (children->index) bytes += children->index->getMemoryUsed();
+    }
+    return bytes;
 }
 
 Variable *Variable::ref() {
@@ -1309,10 +2714,56 @@ int Variable::getRefs() const {
     return refs;
 }
 
+// ----------------------------------------------------------------------------------- CALL FRAME
+
+CallFrame::CallFrame(Variable *function, Variable *thisVar, VariableLink **arguments, int argumentCount, CallFrame *caller)
+    : function(function), thisVar(thisVar), arguments(arguments), argumentCount(argumentCount), returnVar(0), caller(caller) {
+}
+
+CallFrame::~CallFrame() {
+    if (returnVar) returnVar->unref();
+}
+
+Variable *CallFrame::getThis() const {
+    return thisVar ? thisVar : Variable::getUndefinedValue();
+}
+
+Variable *CallFrame::getArgument(int n) const {
+    return n>=0 && n<argumentCount ? arguments[n]->var : Variable::getUndefinedValue();
+}
+
+Variable *CallFrame::getParameter(const Name &name) const {
+    if (name == Name::getThis()) return getThis();
+    int n = 0;
+    for (VariableLink *v = function->firstChild; v; v = v->nextSibling, n++)
+      if (v->name == name) return getArgument(n);
+    return Variable::getUndefinedValue();
+}
+
+Variable *CallFrame::getReturnVar() {
+    if (!returnVar || returnVar->isImmortal())
+      setReturnVar(returnVar ? returnVar->deepCopy() : new Variable());
+    return returnVar;
+}
+
+void CallFrame::setReturnVar(Variable *var) {
+    if (var) var->ref();
+    if (returnVar) returnVar->unref();
+    returnVar = var;
+}
+
+Variable *CallFrame::getResult() const {
+    return returnVar ? returnVar : Variable::getUndefinedValue();
+}
+
 // ----------------------------------------------------------------------------------- INTERPRETER
 
 Interpreter::Interpreter() {
     l = 0;
+    engine = ENGINE_VM;
+    code = 0;
+    returning = false;
+    frame = 0;
     root = (new Variable(TINYJS_BLANK_DATA, VARIABLE_OBJECT))->ref();
     // Add built-in classes
     stringClass = (new Variable(TINYJS_BLANK_DATA, VARIABLE_OBJECT))->ref();
@@ -1340,39 +2791,76 @@ void Interpreter::trace() {
     root->trace();
 }
 
+void Interpreter::setEngine(int engine) {
+    this->engine = engine;
+}
+
+int Interpreter::getEngine() const {
+    return engine;
+}
+
+void Interpreter::getPoolStats(PoolStats &variables, PoolStats &links) const {
+#if TINYJS_USE_POOLS
+    variables = variablePool.stats;
+    links = linkPool.stats;
+#else
+    memset(&variables, 0, sizeof(variables));
+    memset(&links, 0, sizeof(links));
+#endif
+}
+
+std::string Interpreter::getErrorMessage(Exception *e, const std::string &position) const {
+    std::ostringstream msg;
+    msg << "Error " << e->text;
+#ifdef TINYJS_CALL_STACK
+    for (int i=(int)call_stack.size()-1;i>=0;i--) {
+      const CallStackEntry &call = call_stack.at(i);
+      msg << "\n" << i << ": " << call.function.str() << " from ";
+      if (call.from.source) msg << call.from.source->getPosition(call.from.start);
+    }
+#endif
+    msg << " at " << position;
+    return msg.str();
+}
+
 void Interpreter::execute(const std::string &code) {
+    if (engine != ENGINE_LEGACY) {
+        executeCompiled(code);
+        return;
+    }
     Lexer *oldLex = l;
     std::vector<Variable*> oldScopes = scopes;
+    CallFrame *oldFrame = frame;
     l = new Lexer(code);
 #ifdef TINYJS_CALL_STACK
     call_stack.clear();
 #endif
     scopes.clear();
     scopes.push_back(root);
+    frame = 0;
     try {
         bool execute = true;
         while (l->tk) statement(execute);
     } catch (Exception *e) {
-        std::ostringstream msg;
-        msg << "Error " << e->text;
-#ifdef TINYJS_CALL_STACK
-        for (int i=(int)call_stack.size()-1;i>=0;i--)
-          msg << "\n" << i << ": " << call_stack.at(i);
-#endif
-        msg << " at " << l->getPosition();
+        std::string msg = getErrorMessage(e, l->getPosition());
         delete l;
         l = oldLex;
+        frame = oldFrame;
 
-        throw new Exception(msg.str());
+        throw new Exception(msg);
     }
     delete l;
     l = oldLex;
     scopes = oldScopes;
+    frame = oldFrame;
 }
 
 VariableLink Interpreter::evaluateComplex(const std::string &code) {
+    if (engine != ENGINE_LEGACY)
+        return evaluateCompiled(code);
     Lexer *oldLex = l;
     std::vector<Variable*> oldScopes = scopes;
+    CallFrame *oldFrame = frame;
 
     l = new Lexer(code);
 #ifdef TINYJS_CALL_STACK
@@ -1380,6 +2868,7 @@ VariableLink Interpreter::evaluateComplex(const std::string &code) {
 #endif
     scopes.clear();
     scopes.push_back(root);
+    frame = 0;
     VariableLink *v = 0;
     try {
         bool execute = true;
@@ -1389,21 +2878,17 @@ VariableLink Interpreter::evaluateComplex(const std::string &code) {
           if (l->tk!=LEXER_EOF) l->match(';');
         } while (l->tk!=LEXER_EOF);
     } catch (Exception *e) {
-      std::ostringstream msg;
-      msg << "Error " << e->text;
-#ifdef TINYJS_CALL_STACK
-      for (int i=(int)call_stack.size()-1;i>=0;i--)
-        msg << "\n" << i << ": " << call_stack.at(i);
-#endif
-      msg << " at " << l->getPosition();
+      std::string msg = getErrorMessage(e, l->getPosition());
       delete l;
       l = oldLex;
+      frame = oldFrame;
 
-      throw new Exception(msg.str());
+      throw new Exception(msg);
     }
     delete l;
     l = oldLex;
     scopes = oldScopes;
+    frame = oldFrame;
 
     if (v) {
         VariableLink r = *v;
@@ -1421,7 +2906,7 @@ std::string Interpreter::evaluate(const std::string &code) {
 void Interpreter::parseFunctionArguments(Variable *funcVar) {
   l->match('(');
   while (l->tk!=')') {
-      funcVar->addChildNoDup(l->tkStr);
+      funcVar->addChildNoDup(l->tkName);
       l->match(LEXER_ID);
       if (l->tk!=')') l->match(',');
   }
@@ -1429,13 +2914,21 @@ void Interpreter::parseFunctionArguments(Variable *funcVar) {
 }
 
 void Interpreter::addNative(const std::string &funcDesc, JSCallback ptr, void *userdata) {
+    addNativeFunction(funcDesc)->setCallback(ptr, userdata);
+}
+
+void Interpreter::addNative(const std::string &funcDesc, JSNativeCallback ptr, void *userdata) {
+    addNativeFunction(funcDesc)->setCallback(ptr, userdata);
+}
+
+Variable *Interpreter::addNativeFunction(const std::string &funcDesc) {
     Lexer *oldLex = l;
     l = new Lexer(funcDesc);
 
     Variable *base = root;
 
     l->match(LEXER_RESERVED_FUNCTION);
-    std::string funcName = l->tkStr;
+    std::string funcName = l->tkStr.str();
     l->match(LEXER_ID);
     /* Check for dots, we might want to do something like function String.substring ... */
     while (l->tk == '.') {
@@ -1444,17 +2937,17 @@ void Interpreter::addNative(const std::string &funcDesc, JSCallback ptr, void *u
       // if it doesn't exist, make an object class
       if (!link) link = base->addChild(funcName, new Variable(TINYJS_BLANK_DATA, VARIABLE_OBJECT));
       base = link->var;
-      funcName = l->tkStr;
+      funcName = l->tkStr.str();
       l->match(LEXER_ID);
     }
 
     Variable *funcVar = new Variable(TINYJS_BLANK_DATA, VARIABLE_FUNCTION | VARIABLE_NATIVE);
-    funcVar->setCallback(ptr, userdata);
     parseFunctionArguments(funcVar);
     delete l;
     l = oldLex;
 
     base->addChild(funcName, funcVar);
+    return funcVar;
 }
 
 VariableLink *Interpreter::parseFunctionDefinition() {
@@ -1463,7 +2956,7 @@ VariableLink *Interpreter::parseFunctionDefinition() {
   std::string funcName = TINYJS_TEMP_NAME;
   /* we can have functions without names */
   if (l->tk==LEXER_ID) {
-    funcName = l->tkStr;
+    funcName = l->tkStr.str();
     l->match(LEXER_ID);
   }
   VariableLink *funcVar = new VariableLink(new Variable(TINYJS_BLANK_DATA, VARIABLE_FUNCTION), funcName);
@@ -1471,7 +2964,7 @@ VariableLink *Interpreter::parseFunctionDefinition() {
   int funcBegin = l->tokenStart;
   bool noexecute = false;
   block(noexecute);
-  funcVar->var->stringData = l->getSubString(funcBegin);
+  funcVar->var->functionData->code = l->getSubSource(funcBegin);
   return funcVar;
 }
 
@@ -1483,25 +2976,22 @@ VariableLink *Interpreter::functionCall(bool &execute, VariableLink *function, V
   if (execute) {
     if (!function->var->isFunction()) {
       std::ostringstream msg;
-      msg << "Expecting '" << function->name << "' to be a function";
+      msg << "Expecting '" << function->name.str() << "' to be a function";
       throw new Exception(msg.str());
     }
     l->match('(');
-    // create a new symbol table entry for execution of this function
-    Variable *functionRoot = new Variable(TINYJS_BLANK_DATA, VARIABLE_FUNCTION);
-    if (parent)
-      functionRoot->addChildNoDup("this", parent);
-    // grab in all parameters
+    // grab in all the arguments
+    std::vector<VariableLink*> arguments;
     VariableLink *v = function->var->firstChild;
     while (v) {
         VariableLink *value = base(execute);
         if (execute) {
             if (value->var->isBasic()) {
               // pass by value
-              functionRoot->addChild(v->name, value->var->deepCopy());
+              arguments.push_back(new VariableLink(value->var->deepCopy()));
             } else {
               // pass by reference
-              functionRoot->addChild(v->name, value->var);
+              arguments.push_back(new VariableLink(value->var));
             }
         }
         CLEAN(value);
@@ -1509,52 +2999,67 @@ VariableLink *Interpreter::functionCall(bool &execute, VariableLink *function, V
         v = v->nextSibling;
     }
     l->match(')');
-    // setup a return variable
-    VariableLink *returnVar = NULL;
-    // execute function!
-    // add the function's execute space to the symbol table so we can recurse
-    VariableLink *returnVarLink = functionRoot->addChild(TINYJS_RETURN_VAR);
-    scopes.push_back(functionRoot);
+    CallFrame callFrame(function->var, parent, arguments.empty() ? 0 : &arguments[0], (int)arguments.size(), frame);
+    FunctionData *functionData = function->var->functionData;
 #ifdef TINYJS_CALL_STACK
-    call_stack.push_back(function->name + " from " + l->getPosition());
+    call_stack.push_back(CallStackEntry(function->name, l->getSource(), l->tokenLastEnd));
 #endif
 
-    if (function->var->isNative()) {
-        ASSERT(function->var->jsCallback);
-        function->var->jsCallback(functionRoot, function->var->jsCallbackUserData);
+    if (functionData->jsNativeCallback) {
+        // it gets the arguments from the frame, so there's no scope to make
+        functionData->jsNativeCallback(&callFrame, functionData->jsCallbackUserData);
     } else {
-        /* we just want to execute the block, but something could
-         * have messed up and left us with the wrong Lexer, so
-         * we want to be careful here... */
+        // create a new symbol table entry for execution of this function
+        Variable *functionRoot = new Variable(TINYJS_BLANK_DATA, VARIABLE_FUNCTION);
+        if (parent)
+          functionRoot->addChildNoDup(Name::getThis(), parent);
+        v = function->var->firstChild;
+        for (size_t i=0;i<arguments.size();i++, v = v->nextSibling)
+          functionRoot->addChild(v->name, arguments[i]->var);
+        // add the function's execute space to the symbol table so we can recurse
+        scopes.push_back(functionRoot);
+        frame = &callFrame;
+
         Exception *exception = 0;
-        Lexer *oldLex = l;
-        Lexer *newLex = new Lexer(function->var->getString());
-        l = newLex;
-        try {
-          block(execute);
-          // because return will probably have called this, and set execute to false
-          execute = true;
-        } catch (Exception *e) {
-          exception = e;
+        if (function->var->isNative()) {
+            ASSERT(functionData->jsCallback);
+            try {
+              functionData->jsCallback(functionRoot, functionData->jsCallbackUserData);
+            } catch (Exception *e) {
+              exception = e;
+            }
+            // natives using the old API leave the result in a child
+            VariableLink *returnVarLink = functionRoot->findChild(Name::getReturn());
+            if (returnVarLink) callFrame.setReturnVar(returnVarLink->var);
+        } else {
+            /* we just want to execute the block, but something could
+             * have messed up and left us with the wrong Lexer, so
+             * we want to be careful here... */
+            Lexer *oldLex = l;
+            Lexer *newLex = new Lexer(functionData->code);
+            l = newLex;
+            try {
+              block(execute);
+              // because return will probably have called this, and set execute to false
+              execute = true;
+            } catch (Exception *e) {
+              exception = e;
+            }
+            delete newLex;
+            l = oldLex;
         }
-        delete newLex;
-        l = oldLex;
-
+        frame = callFrame.caller;
         if (exception)
           throw exception;
+        scopes.pop_back();
+        delete functionRoot;
     }
 #ifdef TINYJS_CALL_STACK
     if (!call_stack.empty()) call_stack.pop_back();
 #endif
-    scopes.pop_back();
-    /* get the real return var before we remove it from our function */
-    returnVar = new VariableLink(returnVarLink->var);
-    functionRoot->removeLink(returnVarLink);
-    delete functionRoot;
-    if (returnVar)
-      return returnVar;
-    else
-      return new VariableLink(new Variable());
+    for (size_t i=0;i<arguments.size();i++)
+      delete arguments[i];
+    return new VariableLink(callFrame.getResult());
   } else {
     // function, but not executing - just parse args and be done
     l->match('(');
@@ -1582,39 +3087,44 @@ VariableLink *Interpreter::factor(bool &execute) {
     }
     if (l->tk==LEXER_RESERVED_TRUE) {
         l->match(LEXER_RESERVED_TRUE);
-        return new VariableLink(new Variable(1));
+        return new VariableLink(Variable::getBoolValue(true));
     }
     if (l->tk==LEXER_RESERVED_FALSE) {
         l->match(LEXER_RESERVED_FALSE);
-        return new VariableLink(new Variable(0));
+        return new VariableLink(Variable::getBoolValue(false));
     }
     if (l->tk==LEXER_RESERVED_NULL) {
         l->match(LEXER_RESERVED_NULL);
-        return new VariableLink(new Variable(TINYJS_BLANK_DATA,VARIABLE_NULL));
+        return new VariableLink(Variable::getNullValue());
     }
     if (l->tk==LEXER_RESERVED_UNDEFINED) {
         l->match(LEXER_RESERVED_UNDEFINED);
-        return new VariableLink(new Variable(TINYJS_BLANK_DATA,VARIABLE_UNDEFINED));
+        return new VariableLink(Variable::getUndefinedValue());
     }
     if (l->tk==LEXER_ID) {
-        VariableLink *a = execute ? findInScopes(l->tkStr) : new VariableLink(new Variable());
-        //printf("0x%08X for %s at %s\n", (unsigned int)a, l->tkStr.c_str(), l->getPosition().c_str());
+        VariableLink *a = execute ? findInScopes(l->tkName) : new VariableLink(new Variable());
+        //printf("0x%08X for %s at %s\n", (unsigned int)a, l->tkStr.str().c_str(), l->getPosition().c_str());
         /* The parent if we're executing a method call */
         Variable *parent = 0;
 
         if (execute && !a) {
           /* Variable doesn't exist! JavaScript says we should create it
            * (we won't add it here. This is done in the assignment operator)*/
-          a = new VariableLink(new Variable(), l->tkStr);
+          a = new VariableLink(new Variable(), l->tkName);
         }
+        /* A temporary (like the result of a call) that we've gone into a member of, which
+         * has to be kept until we're done with its members */
+        VariableLink *held = 0;
         l->match(LEXER_ID);
         while (l->tk=='(' || l->tk=='.' || l->tk=='[') {
             if (l->tk=='(') { // ------------------------------------- Function Call
+                VariableLink *function = a;
                 a = functionCall(execute, a, parent);
+                if (function != a) CLEAN(function);
             } else if (l->tk == '.') { // ------------------------------------- Record Access
                 l->match('.');
                 if (execute) {
-                  const std::string &name = l->tkStr;
+                  Name name = l->tkName;
                   VariableLink *child = a->var->findChild(name);
                   if (!child) child = findInParentClasses(a->var, name);
                   if (!child) {
@@ -1624,13 +3134,18 @@ VariableLink *Interpreter::factor(bool &execute) {
                       int l = a->var->getArrayLength();
                       child = new VariableLink(new Variable(l));
                     } else if (a->var->isString() && name == "length") {
-                      int l = a->var->getString().size();
+                      int l = a->var->getStringLength();
                       child = new VariableLink(new Variable(l));
                     } else {
+                      a->copyIfConstant();
                       child = a->var->addChild(name);
                     }
                   }
                   parent = a->var;
+                  if (!a->owned) {
+                    CLEAN(held);
+                    held = a;
+                  }
                   a = child;
                 }
                 l->match(LEXER_ID);
@@ -1639,23 +3154,40 @@ VariableLink *Interpreter::factor(bool &execute) {
                 VariableLink *index = base(execute);
                 l->match(']');
                 if (execute) {
-                  VariableLink *child = a->var->findChildOrCreate(index->var->getString());
+                  char buffer[TINYJS_NUMBER_BUFFER];
+                  a->copyIfConstant();
+                  VariableLink *child = a->var->findChildOrCreate(index->var->getStringView(buffer));
                   parent = a->var;
+                  if (!a->owned) {
+                    CLEAN(held);
+                    held = a;
+                  }
                   a = child;
                 }
                 CLEAN(index);
             } else ASSERT(0);
         }
+        if (held) {
+          // if nothing else uses it, what we found goes with it, so keep that on its own
+          if (held->var->getRefs()==1 && a->owned)
+            a = new VariableLink(a->var, a->name);
+          CLEAN(held);
+        }
         return a;
     }
     if (l->tk==LEXER_INT || l->tk==LEXER_FLOAT) {
-        Variable *a = new Variable(l->tkStr,
-            ((l->tk==LEXER_INT)?VARIABLE_INTEGER:VARIABLE_DOUBLE));
+        // numbers are already parsed by the lexer
+        Variable *a;
+        if (l->tk==LEXER_INT) {
+          a = Variable::getIntValue(l->getToken().intValue);
+        } else
+          a = new Variable(l->getToken().floatValue);
         l->match(l->tk);
         return new VariableLink(a);
     }
     if (l->tk==LEXER_STR) {
-        Variable *a = new Variable(l->tkStr, VARIABLE_STRING);
+        Variable *a = new Variable(TINYJS_BLANK_DATA, VARIABLE_STRING);
+        a->setStringLiteral(l->tkName);
         l->match(LEXER_STR);
         return new VariableLink(a);
     }
@@ -1664,7 +3196,7 @@ VariableLink *Interpreter::factor(bool &execute) {
         /* JSON-style object definition */
         l->match('{');
         while (l->tk != '}') {
-          std::string id = l->tkStr;
+          Name id = l->tkName;
           // we only allow strings or IDs on the left hand side of an initialisation
           if (l->tk==LEXER_STR) l->match(LEXER_STR);
           else l->match(LEXER_ID);
@@ -1688,8 +3220,8 @@ VariableLink *Interpreter::factor(bool &execute) {
         int idx = 0;
         while (l->tk != ']') {
           if (execute) {
-            char idx_str[16]; // big enough for 2^32
-            sprintf_s(idx_str, sizeof(idx_str), "%d",idx);
+            char idx_str[TINYJS_NUMBER_BUFFER];
+            formatInteger(idx_str, idx);
 
             VariableLink *a = base(execute);
             contents->addChild(idx_str, a->var);
@@ -1711,11 +3243,11 @@ VariableLink *Interpreter::factor(bool &execute) {
     if (l->tk==LEXER_RESERVED_NEW) {
       // new -> create a new object
       l->match(LEXER_RESERVED_NEW);
-      const std::string &className = l->tkStr;
+      Name className = l->tkName;
       if (execute) {
         VariableLink *objClassOrFunc = findInScopes(className);
         if (!objClassOrFunc) {
-          TRACE("%s is not a valid class name", className.c_str());
+          TRACE("%s is not a valid class name", className.str().c_str());
           return new VariableLink(new Variable());
         }
         l->match(LEXER_ID);
@@ -1724,7 +3256,7 @@ VariableLink *Interpreter::factor(bool &execute) {
         if (objClassOrFunc->var->isFunction()) {
           CLEAN(functionCall(execute, objClassOrFunc, obj));
         } else {
-          obj->addChild(TINYJS_PROTOTYPE_CLASS, objClassOrFunc->var);
+          obj->addChild(Name::getPrototype(), objClassOrFunc->var);
           if (l->tk == '(') {
             l->match('(');
             l->match(')');
@@ -1750,8 +3282,7 @@ VariableLink *Interpreter::unary(bool &execute) {
         l->match('!'); // binary not
         a = factor(execute);
         if (execute) {
-            Variable zero(0);
-            Variable *res = a->var->mathsOp(&zero, LEXER_EQUAL);
+            Variable *res = a->var->unaryOp('!');
             CREATE_LINK(a, res);
         }
     } else
@@ -1782,8 +3313,7 @@ VariableLink *Interpreter::expression(bool &execute) {
     }
     VariableLink *a = term(execute);
     if (negate) {
-        Variable zero(0);
-        Variable *res = zero.mathsOp(a->var, '-');
+        Variable *res = a->var->unaryOp('-');
         CREATE_LINK(a, res);
     }
 
@@ -1793,8 +3323,15 @@ VariableLink *Interpreter::expression(bool &execute) {
         l->match(l->tk);
         if (op==LEXER_PLUSPLUS || op==LEXER_MINUSMINUS) {
             if (execute) {
-                Variable one(1);
-                Variable *res = a->var->mathsOp(&one, op==LEXER_PLUSPLUS ? '+' : '-');
+                NumericValue one(1), value;
+                Variable *res;
+                if (a->var->getNumeric(value)) {
+                  NumericValue::maths(value, one, op==LEXER_PLUSPLUS ? '+' : '-', value);
+                  res = new Variable(value);
+                } else {
+                  Variable oneVar(1);
+                  res = a->var->mathsOp(&oneVar, op==LEXER_PLUSPLUS ? '+' : '-');
+                }
                 VariableLink *oldValue = new VariableLink(a->var);
                 // in-place add/subtract
                 a->replaceWith(res);
@@ -1823,9 +3360,11 @@ VariableLink *Interpreter::shift(bool &execute) {
     int shift = execute ? b->var->getInt() : 0;
     CLEAN(b);
     if (execute) {
-      if (op==LEXER_LSHIFT) a->var->setInt(a->var->getInt() << shift);
-      if (op==LEXER_RSHIFT) a->var->setInt(a->var->getInt() >> shift);
-      if (op==LEXER_RSHIFTUNSIGNED) a->var->setInt(((unsigned int)a->var->getInt()) >> shift);
+      int value = a->var->getInt();
+      if (op==LEXER_LSHIFT) value = value << shift;
+      if (op==LEXER_RSHIFT) value = value >> shift;
+      if (op==LEXER_RSHIFTUNSIGNED) value = ((unsigned int)value) >> shift;
+      CREATE_LINK(a, Variable::getIntValue(value));
     }
   }
   return a;
@@ -1921,7 +3460,7 @@ VariableLink *Interpreter::base(bool &execute) {
         /* If we're assigning to this and we don't have a parent,
          * add it to the symbol table root as per JavaScript. */
         if (execute && !lhs->owned) {
-          if (lhs->name.length()>0) {
+          if (!lhs->name.empty()) {
             VariableLink *realLhs = root->addChildNoDup(lhs->name, lhs->var);
             CLEAN(lhs);
             lhs = realLhs;
@@ -1935,12 +3474,10 @@ VariableLink *Interpreter::base(bool &execute) {
         if (execute) {
             if (op=='=') {
                 lhs->replaceWith(rhs);
-            } else if (op==LEXER_PLUSEQUAL) {
-                Variable *res = lhs->var->mathsOp(rhs->var, '+');
-                lhs->replaceWith(res);
-            } else if (op==LEXER_MINUSEQUAL) {
-                Variable *res = lhs->var->mathsOp(rhs->var, '-');
-                lhs->replaceWith(res);
+            } else if (op==LEXER_PLUSEQUAL || op==LEXER_MINUSEQUAL) {
+                int mathsOp = op==LEXER_PLUSEQUAL ? '+' : '-';
+                if (!lhs->var->mathsOpInPlace(rhs->var, mathsOp))
+                  lhs->replaceWith(lhs->var->mathsOp(rhs->var, mathsOp));
             } else ASSERT(0);
         }
         CLEAN(rhs);
@@ -1949,19 +3486,14 @@ VariableLink *Interpreter::base(bool &execute) {
 }
 
 void Interpreter::block(bool &execute) {
-    l->match('{');
     if (execute) {
+      l->match('{');
       while (l->tk && l->tk!='}')
         statement(execute);
       l->match('}');
     } else {
-      // fast skip of blocks
-      int brackets = 1;
-      while (l->tk && brackets) {
-        if (l->tk == '{') brackets++;
-        if (l->tk == '}') brackets--;
-        l->match(l->tk);
-      }
+      // fast skip of blocks, using the lexer's table of matching braces
+      l->skipBlock();
     }
 
 }
@@ -1989,14 +3521,14 @@ void Interpreter::statement(bool &execute) {
         while (l->tk != ';') {
           VariableLink *a = 0;
           if (execute)
-            a = scopes.back()->findChildOrCreate(l->tkStr);
+            a = scopes.back()->findChildOrCreate(l->tkName);
           l->match(LEXER_ID);
           // now do stuff defined with dots
           while (l->tk == '.') {
               l->match('.');
               if (execute) {
                   VariableLink *lastA = a;
-                  a = lastA->var->findChildOrCreate(l->tkStr);
+                  a = lastA->var->findChildOrCreate(l->tkName);
               }
               l->match(LEXER_ID);
           }
@@ -2026,104 +3558,44 @@ void Interpreter::statement(bool &execute) {
             statement(cond ? noexecute : execute);
         }
     } else if (l->tk==LEXER_RESERVED_WHILE) {
-        // We do repetition by pulling out the string representing our statement
-        // there's definitely some opportunity for optimisation here
+        // The first time round is run from the tokens. After that the loop is
+        // parsed once, and repeatLoop walks the tree rather than re-lexing it
+        int whileStart = l->tokenStart;
         l->match(LEXER_RESERVED_WHILE);
         l->match('(');
-        int whileCondStart = l->tokenStart;
         bool noexecute = false;
         VariableLink *cond = base(execute);
         bool loopCond = execute && cond->var->getBool();
         CLEAN(cond);
-        Lexer *whileCond = l->getSubLex(whileCondStart);
         l->match(')');
-        int whileBodyStart = l->tokenStart;
         statement(loopCond ? execute : noexecute);
-        Lexer *whileBody = l->getSubLex(whileBodyStart);
-        Lexer *oldLex = l;
-        int loopCount = TINYJS_LOOP_MAX_ITERATIONS;
-        while (loopCond && loopCount-->0) {
-            whileCond->reset();
-            l = whileCond;
-            cond = base(execute);
-            loopCond = execute && cond->var->getBool();
-            CLEAN(cond);
-            if (loopCond) {
-                whileBody->reset();
-                l = whileBody;
-                statement(execute);
-            }
-        }
-        l = oldLex;
-        delete whileCond;
-        delete whileBody;
-
-        if (loopCount<=0) {
-            root->trace();
-            TRACE("WHILE Loop exceeded %d iterations at %s\n", TINYJS_LOOP_MAX_ITERATIONS, l->getPosition().c_str());
-            throw new Exception("LOOP_ERROR");
-        }
+        if (loopCond && execute)
+            repeatLoop(l->getSubSource(whileStart), execute);
     } else if (l->tk==LEXER_RESERVED_FOR) {
+        int forStart = l->tokenStart;
         l->match(LEXER_RESERVED_FOR);
         l->match('(');
         statement(execute); // initialisation
         //l->match(';');
-        int forCondStart = l->tokenStart;
         bool noexecute = false;
         VariableLink *cond = base(execute); // condition
         bool loopCond = execute && cond->var->getBool();
         CLEAN(cond);
-        Lexer *forCond = l->getSubLex(forCondStart);
         l->match(';');
-        int forIterStart = l->tokenStart;
         CLEAN(base(noexecute)); // iterator
-        Lexer *forIter = l->getSubLex(forIterStart);
         l->match(')');
-        int forBodyStart = l->tokenStart;
         statement(loopCond ? execute : noexecute);
-        Lexer *forBody = l->getSubLex(forBodyStart);
-        Lexer *oldLex = l;
-        if (loopCond) {
-            forIter->reset();
-            l = forIter;
-            CLEAN(base(execute));
-        }
-        int loopCount = TINYJS_LOOP_MAX_ITERATIONS;
-        while (execute && loopCond && loopCount-->0) {
-            forCond->reset();
-            l = forCond;
-            cond = base(execute);
-            loopCond = cond->var->getBool();
-            CLEAN(cond);
-            if (execute && loopCond) {
-                forBody->reset();
-                l = forBody;
-                statement(execute);
-            }
-            if (execute && loopCond) {
-                forIter->reset();
-                l = forIter;
-                CLEAN(base(execute));
-            }
-        }
-        l = oldLex;
-        delete forCond;
-        delete forIter;
-        delete forBody;
-        if (loopCount<=0) {
-            root->trace();
-            TRACE("FOR Loop exceeded %d iterations at %s\n", TINYJS_LOOP_MAX_ITERATIONS, l->getPosition().c_str());
-            throw new Exception("LOOP_ERROR");
-        }
+        // repeatLoop runs the iterator, then carries on round
+        if (loopCond && execute)
+            repeatLoop(l->getSubSource(forStart), execute);
     } else if (l->tk==LEXER_RESERVED_RETURN) {
         l->match(LEXER_RESERVED_RETURN);
         VariableLink *result = 0;
         if (l->tk != ';')
           result = base(execute);
         if (execute) {
-          VariableLink *resultVar = scopes.back()->findChild(TINYJS_RETURN_VAR);
-          if (resultVar)
-            resultVar->replaceWith(result);
+          if (frame)
+            frame->setReturnVar(result ? result->var : 0);
           else
             TRACE("RETURN statement, but not in a function.\n");
           execute = false;
@@ -2177,9 +3649,9 @@ bool Interpreter::setVariable(const std::string &path, const std::string &varDat
     // return result
     if (var) {
         if (var->isInt())
-            var->setInt((int)strtol(varData.c_str(),0,0));
+            var->setInt((int)parseInteger(varData.c_str()));
         else if (var->isDouble())
-            var->setDouble(strtod(varData.c_str(),0));
+            var->setDouble(parseNumber(varData.c_str()));
         else
             var->setString(varData.c_str());
         return true;
@@ -2189,7 +3661,7 @@ bool Interpreter::setVariable(const std::string &path, const std::string &varDat
 }
 
 /// Finds a child, looking recursively up the scopes
-VariableLink *Interpreter::findInScopes(const std::string &childName) const {
+VariableLink *Interpreter::findInScopes(const Name &childName) const {
     for (int s=scopes.size()-1;s>=0;s--) {
       VariableLink *v = scopes[s]->findChild(childName);
       if (v) return v;
@@ -2199,13 +3671,13 @@ VariableLink *Interpreter::findInScopes(const std::string &childName) const {
 }
 
 /// Look up in any parent classes of the given object
-VariableLink *Interpreter::findInParentClasses(Variable *object, const std::string &name) const {
+VariableLink *Interpreter::findInParentClasses(Variable *object, const Name &name) const {
     // Look for links to actual parent classes
-    VariableLink *parentClass = object->findChild(TINYJS_PROTOTYPE_CLASS);
+    VariableLink *parentClass = object->findChild(Name::getPrototype());
     while (parentClass) {
       VariableLink *implementation = parentClass->var->findChild(name);
       if (implementation) return implementation;
-      parentClass = parentClass->var->findChild(TINYJS_PROTOTYPE_CLASS);
+      parentClass = parentClass->var->findChild(Name::getPrototype());
     }
     // else fake it for strings and finally objects
     if (object->isString()) {
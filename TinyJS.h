@@ -44,6 +44,7 @@
 #endif
 #include <string>
 #include <vector>
+#include <map>
 
 #ifndef TRACE
   #define TRACE printf
@@ -111,6 +112,7 @@ enum VARIABLE_FLAGS {
     VARIABLE_STRING      = 32, // string
     VARIABLE_NULL        = 64, // it seems null is its own data type
     VARIABLE_NATIVE      = 128, // to specify this is a native function
+    VARIABLE_IMMORTAL    = 256, // a constant shared by everything that uses it (see Variable::getIntValue)
     VARIABLE_NUMERICMASK = VARIABLE_NULL |
                            VARIABLE_DOUBLE |
                            VARIABLE_INTEGER,
@@ -123,6 +125,45 @@ enum VARIABLE_FLAGS {
                         VARIABLE_NULL,
 };
 
+enum INTERPRETER_ENGINES {
+    ENGINE_LEGACY = 0, ///< Interpret straight from the tokens, re-lexing as it goes
+    ENGINE_AST, ///< Parse once into a tree and walk it
+    ENGINE_VM, ///< Parse once, compile the tree to bytecode and run that
+};
+
+/// Objects with more properties than this no longer have a Shape
+#define TINYJS_SHAPE_MAX_PROPERTIES 32
+/// Variables with more children than this find them through a ChildIndex
+#define TINYJS_DICTIONARY_THRESHOLD 32
+/// Arrays given an index more than this far past twice their length become sparse
+#define TINYJS_ARRAY_SPARSE_GAP 64
+/// Joining strings makes a rope (see StringData) if the result is at least this long
+#define TINYJS_ROPE_MIN_LENGTH 256
+/// Ints from TINYJS_SMALL_INT_MIN to TINYJS_SMALL_INT_MAX are shared constants (see Variable::getIntValue)
+#define TINYJS_SMALL_INT_MIN -128
+#define TINYJS_SMALL_INT_MAX 1023
+
+#ifndef TINYJS_USE_POOLS
+  /// Allocate Variables and VariableLinks from a Pool rather than straight from the heap
+  #define TINYJS_USE_POOLS 1
+#endif
+#ifndef TINYJS_USE_SIMD
+  #if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+    /// Have the Lexer skip whitespace and comments and find the ends of identifiers and strings with SSE2/AVX2
+    #define TINYJS_USE_SIMD 1
+  #else
+    #define TINYJS_USE_SIMD 0
+  #endif
+#endif
+/// Size in bytes of each slab a Pool carves its blocks from
+#define TINYJS_POOL_SLAB_SIZE 65536
+
+#if defined(_MSC_VER)
+  #define TINYJS_THREAD_LOCAL __declspec(thread)
+#else
+  #define TINYJS_THREAD_LOCAL __thread
+#endif
+
 #define TINYJS_RETURN_VAR "return"
 #define TINYJS_PROTOTYPE_CLASS "prototype"
 #define TINYJS_TEMP_NAME ""
@@ -131,72 +172,422 @@ enum VARIABLE_FLAGS {
 /// convert the given string into a quoted string suitable for javascript
 std::string getJSString(const std::string &str);
 
+/// Size of the buffer formatInteger and formatNumber need
+#define TINYJS_NUMBER_BUFFER 32
+/// Write value into buf as "%ld" would, returning the length
+int formatInteger(char *buf, long value);
+/// Write value into buf as JavaScript would, with digits that round-trip (read back as the same double), returning the length
+int formatNumber(char *buf, double value);
+/// Read an integer as strtol(str, end, 0) does (so with hex and octal), but quicker for plain decimal
+long parseInteger(const char *str, const char **end=0);
+/// Read a number as strtod does, but quicker for the common cases
+double parseNumber(const char *str, const char **end=0);
+
+/// Some characters that belong to something else, like C++17's std::string_view
+class StringView
+{
+public:
+    StringView() : data(0), length(0) {}
+    StringView(const char *data, int length) : data(data), length(length) {}
+    StringView(const std::string &str) : data(str.data()), length((int)str.size()) {}
+    StringView(const char *str) : data(str), length((int)std::char_traits<char>::length(str)) {}
+
+    const char *data; ///< First character (not nul terminated)
+    int length; ///< Number of characters
+
+    bool empty() const { return length==0; }
+    std::string str() const { return std::string(data, length); } ///< Copy the characters
+    StringView substr(int start, int count) const { return StringView(data+start, count); } ///< Characters start to start+count, which must be in range
+    int find(const StringView &search, int from=0) const; ///< Position of the first search at or after from, or -1
+    int compare(const StringView &other) const; ///< <0, 0 or >0 as this sorts before, the same as or after other
+
+    bool operator==(const StringView &other) const { return length==other.length && compare(other)==0; }
+    bool operator!=(const StringView &other) const { return !(*this==other); }
+};
+
 class Exception {
 public:
     std::string text;
     Exception(const std::string &exceptionText);
 };
 
+class StringData;
+
+/// One interned name (see Name)
+class NameData
+{
+public:
+    int refs; ///< The number of Names using this
+    unsigned int hash; ///< Name::hashOf(str)
+    int elementIndex; ///< See Name::getElementIndex
+    NameData *next; ///< Next in the same bucket of the table
+    StringData *literal; ///< See Name::getLiteral, 0 until first needed
+    std::string str;
+};
+
+/** An atom: the name of a VariableLink, or an identifier or string found by the Lexer.
+    Names are interned in a table (one per thread, as the pools are), so a Name is just
+    a pointer, everything with the same name shares one copy of it and its hash, and
+    two Names are equal only if they point to the same data. The Lexer makes Names for
+    identifiers and strings as it splits up its input, so looking up a child or a scope
+    from a script is a pointer comparison, and a string only has to be interned when
+    the host passes one in. The empty name (as temporaries have) is a null pointer, and
+    doesn't use the table. Names must not be passed between threads. */
+class Name
+{
+public:
+    Name() : data(0) {}
+    Name(const std::string &str) : data(str.empty() ? 0 : intern(str)) {}
+    Name(const char *str) : data(*str ? intern(StringView(str)) : 0) {}
+    Name(const StringView &str) : data(str.empty() ? 0 : intern(str)) {} ///< Only copies str if it isn't interned yet
+    Name(const Name &name) : data(name.data) { if (data) data->refs++; }
+    ~Name() { if (data) release(data); }
+    Name &operator=(const Name &name);
+
+    const std::string &str() const { return data ? data->str : blank; }
+    operator const std::string &() const { return str(); }
+    bool empty() const { return data==0; }
+    unsigned int getHash() const { return data ? data->hash : hashOf(blank); }
+    /// Index for Variable::elements, -1 if this isn't a number, -2 if it can't be kept there (like "01")
+    int getElementIndex() const { return data ? data->elementIndex : -2; }
+    static unsigned int hashOf(const StringView &str); ///< The hash of a name, for finding it in a hash table
+    /** The characters as a string value, made the first time a string literal with them
+        is used and then shared by all of them, so literals don't copy their contents
+        each time they are evaluated (0 for the empty name). */
+    StringData *getLiteral() const;
+
+    static const Name &getThis(); ///< "this"
+    static const Name &getReturn(); ///< TINYJS_RETURN_VAR
+    static const Name &getPrototype(); ///< TINYJS_PROTOTYPE_CLASS
+
+    bool operator==(const Name &name) const { return data==name.data; }
+    bool operator!=(const Name &name) const { return data!=name.data; }
+    bool operator==(const std::string &str) const { return this->str()==str; }
+    bool operator!=(const std::string &str) const { return this->str()!=str; }
+    bool operator==(const char *str) const { return this->str()==str; }
+    bool operator!=(const char *str) const { return this->str()!=str; }
+    bool operator<(const Name &name) const { return data<name.data; } ///< Any order, for std::map
+protected:
+    NameData *data;
+
+    static const std::string blank;
+    static NameData *intern(const StringView &str); ///< Find str in the table (adding it if needed) and ref it
+    static void release(NameData *data); ///< Unref data, removing it from the table when unused
+};
+
+/// A token, as found by the Lexer when it first scans its input
+class Token
+{
+public:
+    int tk; ///< The type of the token
+    int start; ///< Position in the data of the first character
+    int end; ///< Position in the data of the last character
+    Name name; ///< An identifier or string's contents, or empty
+    int match; ///< For a '{', the index of its matching '}' (or -1 if there isn't one)
+    union {
+      long intValue; ///< Value of a LEXER_INT
+      double floatValue; ///< Value of a LEXER_FLOAT
+    };
+};
+
+/** Some source code, which Lexers, their sub-lexers and the functions defined in it
+    all point into by position rather than copying. It never changes, so it is split
+    into tokens once (by the first Lexer over it) and they are shared as well. */
+class Source
+{
+public:
+    Source(const std::string &text);
+
+    const char *data; ///< The text (nul terminated)
+    int length; ///< Number of characters in data
+    std::vector<Token> tokens; ///< Tokens of the whole text
+    bool tokenized; ///< Has a Lexer filled in tokens yet?
+
+    std::string getPosition(int pos); ///< Return a string representing the position in lines and columns of the character pos given
+
+    Source *ref(); ///< Add reference to this source
+    void unref(); ///< Remove a reference, and delete this source if required
+protected:
+    ~Source();
+    int refs; ///< The number of references held to this source
+    std::vector<int> lineStarts; ///< Position of the start of each line, made by the first getPosition
+};
+
+/// Part of a Source, which it holds a reference to
+class SourceSlice
+{
+public:
+    SourceSlice() : source(0), start(0), end(0) {}
+    SourceSlice(Source *source, int start, int end);
+    SourceSlice(const SourceSlice &slice);
+    ~SourceSlice();
+    SourceSlice &operator=(const SourceSlice &slice);
+
+    Source *source; ///< The source, or 0 if this is empty
+    int start, end; ///< Position of the first character, and just past the last
+
+    StringView view() const { return source ? StringView(source->data+start, end-start) : StringView(); }
+    std::string str() const { return view().str(); } ///< Copy the characters
+};
+
 class Lexer
 {
 public:
     Lexer(const std::string &input);
+    Lexer(const SourceSlice &slice); ///< Lex part of a Source, without copying or re-lexing it
     Lexer(Lexer *owner, int startChar, int endChar);
     ~Lexer(void);
 
-    char currCh, nextCh;
     int tk; ///< The type of the token that we have
     int tokenStart; ///< Position in the data at the beginning of the token we have here
     int tokenEnd; ///< Position in the data at the last character of the token we have here
     int tokenLastEnd; ///< Position in the data at the last character of the last token
-    std::string tkStr; ///< Data contained in the token we have here
+    StringView tkStr; ///< Text of the token we have here (a string's contents, without quotes and escapes)
+    Name tkName; ///< tkStr as a Name, for identifiers and strings
 
     void match(int expected_tk); ///< Lexical match wotsit
     static std::string getTokenStr(int token); ///< Get the string representation of the given token
+    static const char *getScanKernels(); ///< The kernels used to scan source ("avx2", "sse2" or "scalar") - picked with CPUID
     void reset(); ///< Reset this lex so we can start again
+    const Token &getToken() const; ///< The token we have here, including the value of numbers
+    void skipBlock(); ///< On a '{', move straight past its matching '}' (or to the end if it has none)
 
     std::string getSubString(int pos); ///< Return a sub-string from the given position up until right now
+    SourceSlice getSubSource(int pos); ///< As getSubString, but pointing into our Source rather than copying it
     Lexer *getSubLex(int lastPosition); ///< Return a sub-lexer from the given position up until right now
 
     std::string getPosition(int pos=-1); ///< Return a string representing the position in lines and columns of the character pos given
+    Source *getSource() const { return source; } ///< The source we are lexing part of
+    static std::string formatPosition(const char *data, int dataLength, int pos); ///< As getPosition, for any string
 
 protected:
-    /* When we go into a loop, we use getSubLex to get a lexer for just the sub-part of the
-       relevant string. This doesn't re-allocate and copy the string, but instead copies
-       the data pointer and sets dataOwned to false, and dataStart/dataEnd to the relevant things. */
-    char *data; ///< Data string to get tokens from
+    /* All lexers over some source (like sub-lexers for loops, and lexers for the
+       functions defined in it) share one Source, and its tokens. Each only has its
+       own range of the data (dataStart/dataEnd) and of the tokens. */
+    Source *source; ///< The source we are lexing part of
+    const char *data; ///< source->data
     int dataStart, dataEnd; ///< Start and end position in data string
-    bool dataOwned; ///< Do we own this data string?
+    int firstToken, lastToken; ///< Range of the source's tokens this lexer returns (lastToken is excluded)
+    int tokenIndex; ///< Index in the table of the token we have here
+    Token eof; ///< Returned once we run out of tokens
 
+    void init(Source *source, int startChar, int endChar); ///< Lex the given part of source
+    void setToken(int index); ///< Make the token at the given index the one we have here
+    void tokenize(); ///< Fill the source's tokens from the whole of its data
+
+    // Scanning, only used by tokenize
+    std::string scanStr; ///< Text of the token being scanned
+    char currCh, nextCh;
     int dataPos; ///< Position in data (we CAN go past the end of the string here)
 
     void getNextCh();
+    void scanTo(int pos); ///< Carry on scanning from data[pos], after working on data directly
     void getNextToken(); ///< Get the text token from our text string
 };
 
+/// How much a Pool has allocated (see Interpreter::getPoolStats)
+class PoolStats
+{
+public:
+    long allocations; ///< Blocks handed out
+    long frees; ///< Blocks given back
+    long inUse; ///< Blocks handed out and not given back yet
+    long slabs; ///< Slabs allocated from the heap
+    long bytes; ///< Total size of the slabs
+};
+
+/** Hands out blocks of one size from big slabs, keeping the ones given back on a list
+    to hand out again. Each thread has its own Pool for Variables and one for
+    VariableLinks, so there is no locking. Slabs are kept until the program exits, so
+    a block given back on another thread just joins that thread's list. Pools are
+    plain data, so they can be thread local and start off zeroed. */
+class Pool
+{
+public:
+    void *allocate(size_t size); ///< Get a block (always ask for the same size)
+    void release(void *block); ///< Give a block back
+
+    PoolStats stats;
+    void *freeList; ///< Blocks given back, each holding a pointer to the next
+    char *next; ///< Next unused block of the current slab
+    char *end; ///< End of the current slab
+};
+
+/** An int or a double, for doing maths on numbers without needing a Variable (and so
+    a heap allocation) for each result. */
+class NumericValue
+{
+public:
+    NumericValue() : isDouble(false), intData(0), doubleData(0) {}
+    NumericValue(int val) : isDouble(false), intData(val), doubleData(0) {}
+
+    bool isDouble; ///< Otherwise it's an int
+    int intData;
+    double doubleData;
+
+    /// Do a maths op on two numbers, as Variable::mathsOp does (result can be a or b)
+    static void maths(const NumericValue &a, const NumericValue &b, int op, NumericValue &result);
+};
+
 class Variable;
+class Node;
+class Bytecode;
+class Value;
+class CompiledCode;
+class CallFrame;
 
 typedef void (*JSCallback)(Variable *var, void *userdata);
+typedef void (*JSNativeCallback)(CallFrame *frame, void *userdata); ///< A native that gets its arguments by position (see CallFrame)
 
 class VariableLink
 {
 public:
-  std::string name;
+  Name name;
   VariableLink *nextSibling;
   VariableLink *prevSibling;
   Variable *var;
   bool owned;
 
-  VariableLink(Variable *var, const std::string &name = TINYJS_TEMP_NAME);
+  VariableLink(Variable *var, const Name &name = Name());
   VariableLink(const VariableLink &link); ///< Copy constructor
   ~VariableLink();
   void replaceWith(Variable *newVar); ///< Replace the Variable pointed to
   void replaceWith(VariableLink *newVar); ///< Replace the Variable pointed to (just dereferences)
+  void copyIfConstant(); ///< If this points to a constant, point to a copy of it instead, so it can be changed
   int getIntName() const; ///< Get the name as an integer (for arrays)
   void setIntName(int n); ///< Set the name as an integer (for arrays)
+
+#if TINYJS_USE_POOLS
+  static void *operator new(size_t size);
+  static void operator delete(void *p, size_t size);
+#endif
+};
+
+/** Hash index of the children of a Variable by name, for when it has too many to
+    search through the list (see TINYJS_DICTIONARY_THRESHOLD). The list still keeps
+    them in order. Where names repeat, the first child in the list is the one that
+    is indexed, just as findChild would find it. */
+class ChildIndex
+{
+public:
+    ChildIndex();
+
+    VariableLink *find(const Name &name) const;
+    void add(VariableLink *link); ///< Index a link that was added to the end of the list
+    void addRenamed(VariableLink *link); ///< Index a link that is already in the list, but has a new name
+    void remove(VariableLink *link); ///< Stop indexing a link before it is removed or renamed
+    size_t getMemoryUsed() const; ///< Bytes used by the index
+protected:
+    std::vector<VariableLink*> table; ///< Open addressing, a size that is a power of 2
+    int used; ///< Entries of the table in use, including removed ones
+    bool duplicates; ///< Have we seen a name twice? If not, removing a link needs no search
+
+    int findEntry(const Name &name) const; ///< Index in table of name, or -1
+    void insert(VariableLink *link); ///< Put a link in the table, growing it if needed
+};
+
+/** The layout of an object: the names of its properties in the order they were added.
+    Objects that get the same properties added in the same order share a Shape, which
+    lets the VM cache where a property is kept (see InlineCache). Shapes form a tree (one per thread),
+    where each child adds one property to its parent, and are deleted once unused. */
+class Shape
+{
+public:
+    static Shape *getEmpty(); ///< The shape with no properties, which everything grows from
+
+    Shape *addProperty(const Name &name); ///< The shape with one more property (not ref'd)
+    int getCount() const { return count; } ///< Number of properties
+
+    Shape *ref(); ///< Add reference to this shape
+    void unref(); ///< Remove a reference, and delete this shape if required
+protected:
+    Shape(Shape *parent, const Name &name);
+    ~Shape();
+
+    Shape *parent; ///< The shape this adds a property to
+    Name name; ///< The name of the property added
+    int count; ///< Number of properties
+    int refs; ///< References from objects, child shapes and caches
+    std::map<Name, Shape*> transitions; ///< Child shapes we know about (not ref'd)
+};
+
+/// What a function Variable holds, kept out of line (see Variable)
+class FunctionData
+{
+public:
+    FunctionData() : jsCallback(0), jsNativeCallback(0), jsCallbackUserData(0), compiled(0) {}
+
+    SourceSlice code; ///< Source of the body (the parameters are children)
+    JSCallback jsCallback; ///< Callback for native functions that get their parameters by name
+    JSNativeCallback jsNativeCallback; ///< Callback for native functions that get their arguments by position
+    void *jsCallbackUserData; ///< user data passed as second argument to native functions
+    CompiledCode *compiled; ///< Parsed body if this is a (non-native) function, 0 until first needed
 };
 
-/// Variable class (containing a doubly-linked list of children)
+/** The characters of a string Variable, which Variables can share as it never changes
+    once made. Joining two strings into a long one makes a rope - a node that just refers
+    to both - and the characters are only copied into one buffer (flattened) the first
+    time they are needed, such as when comparing them or passing them to a native. So
+    building a long string a piece at a time copies each piece once, not every time. */
+class StringData
+{
+public:
+    StringData(const std::string &str);
+    static StringData *join(StringData *left, StringData *right); ///< A rope of left then right
+
+    int length; ///< Number of characters
+
+    const std::string &str(); ///< The characters, flattening this first if it is a rope
+    bool isRope() const { return left!=0; }
+    bool isShared() const { return refs>1; }
+
+    StringData *ref(); ///< Add reference to this string
+    void unref(); ///< Remove a reference, and delete this string (and any rope under it nobody else uses) if required
+    size_t getMemoryUsed() const; ///< Bytes used by this node and its characters (not what a rope refers to)
+protected:
+    StringData();
+    int refs; ///< The number of references held to this string
+    std::string flat; ///< The characters, unless this is a rope
+    StringData *left, *right; ///< The two halves of a rope (0 if flat)
+
+    void flatten(); ///< Copy the characters of the rope into flat, and let go of its halves
+    void setFlat(const std::string &str); ///< Change the characters (only when nothing else uses this)
+
+    friend class Variable;
+};
+
+/** The parts of a Variable only needed once it has children, kept out of line
+    (see Variable). Made by the first addChild, and deleted by removeAllChildren. */
+class ChildList
+{
+public:
+    ChildList() : lastChild(0), count(0), shape(0), index(0), sparse(false) {}
+
+    VariableLink *lastChild;
+    int count; ///< Number of children
+    /* While an object only ever has properties added to it, 'shape' describes its
+       children and 'slots' holds them in the same order. Removing children, or having
+       too many, sets shape to 0. Nothing but addChild/removeLink/removeAllChildren
+       should change the list of children of an object. */
+    Shape *shape; ///< Layout of the children, or 0
+    std::vector<VariableLink*> slots; ///< The children, when there is a shape
+    ChildIndex *index; ///< Children by name, once there are enough of them (or 0)
+    /* Children named "0", "1", ... (as array elements are) are also kept in
+       'elements' by their index, so they can be found without searching and the
+       length of an array is just its size. Very holey arrays, and numbered children
+       that can't be kept there (like "01", or a name given twice), make a Variable
+       sparse: then they are only found by name, until all its children are removed. */
+    std::vector<VariableLink*> elements; ///< Numbered children by index, 0 for holes (none at the end)
+    bool sparse; ///< Are numbered children only found by name?
+};
+
+/** Variable class (containing a doubly-linked list of children)
+
+    Most Variables are leaves - numbers and strings - so a Variable only holds what
+    every value needs. The value is in a union, chosen by the flags: intData for ints,
+    doubleData for doubles, functionData for functions (always set), and stringData for
+    everything else (0 for an empty string, and shared between copies). Anything bigger
+    than that, and everything about the children but the first one, is kept out of line. */
 class Variable
 {
 public:
@@ -205,35 +596,45 @@ public:
     Variable(const std::string &str); ///< Create a string
     Variable(double varData);
     Variable(int val);
+    Variable(const NumericValue &val);
     Variable(const std::vector<unsigned char> &val); ///< Create a array-of-bytes
     ~Variable(void);
 
     Variable *getReturnVar(); ///< If this is a function, get the result value (for use by native functions)
     void setReturnVar(Variable *var); ///< Set the result value. Use this when setting complex return data as it avoids a deepCopy()
-    Variable *getParameter(const std::string &name); ///< If this is a function, get the parameter with the given name (for use by native functions)
+    Variable *getParameter(const Name &name); ///< If this is a function, get the parameter with the given name (for use by native functions)
 
-    VariableLink *findChild(const std::string &childName) const; ///< Tries to find a child with the given name, may return 0
-    VariableLink *findChildOrCreate(const std::string &childName, int varFlags=VARIABLE_UNDEFINED); ///< Tries to find a child with the given name, or will create it with the given flags
+    VariableLink *findChild(const Name &childName) const; ///< Tries to find a child with the given name, may return 0
+    VariableLink *findChildOrCreate(const Name &childName, int varFlags=VARIABLE_UNDEFINED); ///< Tries to find a child with the given name, or will create it with the given flags
     VariableLink *findChildOrCreateByPath(const std::string &path); ///< Tries to find a child with the given path (separated by dots)
-    VariableLink *addChild(const std::string &childName, Variable *child=NULL);
-    VariableLink *addChildNoDup(const std::string &childName, Variable *child=NULL); ///< add a child overwriting any with the same name
+    VariableLink *addChild(const Name &childName, Variable *child=NULL);
+    VariableLink *addChildNoDup(const Name &childName, Variable *child=NULL); ///< add a child overwriting any with the same name
     void removeChild(Variable *child);
     void removeLink(VariableLink *link); ///< Remove a specific link (this is faster than finding via a child)
     void removeAllChildren();
-    Variable *getArrayIndex(int idx) const; ///< The the value at an array index
+    void renameChild(VariableLink *link, const Name &newName); ///< Change the name of one of our children
+    Variable *getArrayIndex(int idx) const; ///< The value at an array index (the null constant for a hole, which must not be changed)
     void setArrayIndex(int idx, Variable *value); ///< Set the value at an array index
     int getArrayLength() const; ///< If this is an array, return the number of items in it (else 0)
     int getChildren() const; ///< Get the number of children
+    VariableLink *getElement(int idx) const { return (children && !children->sparse && idx>=0 && idx<(int)children->elements.size()) ? children->elements[idx] : 0; } ///< The child at an array index if 'elements' has it, else 0 (so look it up by name)
+    VariableLink *getElement(const Variable *idx) const; ///< As getElement, for an index that is a script variable
 
     const std::vector<unsigned char> getArray() const;
     int getInt() const;
     bool getBool() const { return getInt() != 0; }
     double getDouble() const;
     const std::string getString() const;
+    /** The same characters as getString, without copying them. A string gives its own
+        characters, which stay valid until this Variable is changed, and a number is
+        written into buffer (which must have room for TINYJS_NUMBER_BUFFER chars). */
+    StringView getStringView(char *buffer) const;
+    int getStringLength() const; ///< The length of getString() for a string, without flattening a rope
     std::string getParsableString() const; ///< get Data as a parsable javascript string
     void setInt(int num);
     void setDouble(double val);
     void setString(const std::string &str);
+    void setStringLiteral(const Name &str); ///< Set to the string str, sharing Name::getLiteral (which is copied if this is changed)
     void setUndefined();
     void setArray();
     void setArray(const std::vector<unsigned char> &val);
@@ -250,8 +651,25 @@ public:
     bool isUndefined() const { return (flags & VARIABLE_TYPEMASK) == VARIABLE_UNDEFINED; }
     bool isNull() const { return (flags & VARIABLE_NULL)!=0; }
     bool isBasic() const { return firstChild==0; } ///< Is this *not* an array/object/etc
+    bool isImmortal() const { return (flags&VARIABLE_IMMORTAL)!=0; } ///< Is this one of the shared constants?
+
+    /** Values that are used all the time - undefined, null, and small ints (which true
+        and false are) - are immortal constants: each thread has one Variable for each,
+        which everything that wants that value as a temporary shares, and which holds a
+        reference to itself so it is never freed (or changed in place by mathsOpInPlace).
+        They are never stored: addChild, or replaceWith on a link that belongs to a
+        Variable, stores a copy instead, and adding a property to one throws. */
+    static Variable *getUndefinedValue();
+    static Variable *getNullValue();
+    static Variable *getIntValue(long value); ///< The constant, or a new Variable if value is outside TINYJS_SMALL_INT_MIN..TINYJS_SMALL_INT_MAX
+    static Variable *getBoolValue(bool value) { return getIntValue(value); }
 
     Variable *mathsOp(const Variable *b, int op); ///< do a maths op with another script variable
+    Variable *unaryOp(int op); ///< '!' or '-' of this variable (as mathsOp would do 0==this or 0-this)
+    bool mathsOpInPlace(const Variable *b, int op); ///< If both are numbers and nothing else uses this variable, do this = this op b without allocating anything and return true
+    bool mathsOpInPlace(const NumericValue &b, int op); ///< As above, with a number that isn't in a variable
+    bool getNumeric(NumericValue &val) const; ///< If this is a number, get it and return true
+    void setNumeric(const NumericValue &val);
     void copyValue(const Variable *val); ///< copy the value from the value given
     Variable *deepCopy() const; ///< deep copy this node and return the result
 
@@ -259,9 +677,18 @@ public:
     std::string getFlagsAsString() const; ///< For debugging - just dump a string version of the flags
     void getJSON(std::ostringstream &destination, const std::string &linePrefix="") const; ///< Write out all the JS code needed to recreate this script variable to the stream (as JSON)
     void setCallback(JSCallback callback, void *userdata); ///< Set the callback for native functions
+    void setCallback(JSNativeCallback callback, void *userdata); ///< As above, for natives that get their arguments by position
+    size_t getMemoryUsed() const; ///< Bytes used by this Variable, what it keeps out of line and the links to its children (not the children themselves)
+
+#if TINYJS_USE_POOLS
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+#endif
 
     VariableLink *firstChild;
-    VariableLink *lastChild;
+    ChildList *children; ///< Everything else about the children, or 0 if there have been none
+    VariableLink *getLastChild() const { return children ? children->lastChild : 0; }
+    Shape *getShape() const { return children ? children->shape : 0; } ///< Layout of the children, or 0
 
     /// For memory management/garbage collection
     Variable *ref(); ///< Add reference to this variable
@@ -270,14 +697,21 @@ public:
 protected:
     int refs; ///< The number of references held to this - used for garbage collection
 
-    std::string stringData; ///< The contents of this variable if it is a string
-    long intData; ///< The contents of this variable if it is an int
-    double doubleData; ///< The contents of this variable if it is a double
     int flags; ///< the flags determine the type of the variable - int/double/string/etc
-    JSCallback jsCallback; ///< Callback for native functions
-    void *jsCallbackUserData; ///< user data passed as second argument to native functions
+    union {
+      long intData; ///< The contents of this variable if it is an int
+      double doubleData; ///< The contents of this variable if it is a double
+      StringData *stringData; ///< The contents of this variable otherwise (0 if empty)
+      FunctionData *functionData; ///< The code of this variable if it is a function
+    };
 
     void init(); ///< initialisation of data members
+    void setFlags(int newFlags); ///< Change the type, freeing the old value and clearing the new one
+    void setStringData(const std::string &str); ///< Set the string held by something that isn't a number or function
+    void dropShape(); ///< Forget the shape, when the children no longer match it
+    void addElement(VariableLink *link); ///< Keep a new (or renamed) child in 'elements' if it is numbered
+    void removeElement(VariableLink *link); ///< Stop keeping a child in 'elements'
+    void makeSparse(); ///< Stop using 'elements' at all
 
     /** Copy the basic data and flags from the variable given, with no
       * children. Should be used internally only - by copyValue and deepCopy */
@@ -286,6 +720,44 @@ protected:
     friend class Interpreter;
 };
 
+/** One function call that is running. Each is made on the C++ stack by the engine that
+    makes the call, and points to the one that was running when it was made, so the
+    result of a 'return' goes straight into the frame rather than into a child of the
+    scope. Natives added with a JSNativeCallback are given the frame, and get their
+    arguments from it by position - nothing is made for them to look up by name. */
+class CallFrame
+{
+public:
+    CallFrame(Variable *function, Variable *thisVar, VariableLink **arguments, int argumentCount, CallFrame *caller);
+    ~CallFrame();
+
+    Variable *getThis() const; ///< The object the function was called on, or undefined
+    int getArgumentCount() const { return argumentCount; } ///< How many arguments were passed
+    Variable *getArgument(int n) const; ///< The given argument, or undefined if there weren't that many (don't change it - set the result instead)
+    Variable *getParameter(const Name &name) const; ///< The argument for the parameter with the given name (for natives written for the old API)
+    Variable *getReturnVar(); ///< The result, made first if nothing has been returned yet, so it can be set in place
+    void setReturnVar(Variable *var); ///< Set the result to the given Variable, which is shared rather than copied (0 for undefined)
+    Variable *getResult() const; ///< The result, or undefined if nothing was returned
+
+    Variable *function; ///< The function being called
+    Variable *thisVar; ///< What 'this' is, or 0
+    VariableLink **arguments; ///< The arguments, in order
+    int argumentCount;
+    Variable *returnVar; ///< What was returned (we hold a reference), or 0
+    CallFrame *caller; ///< The frame that was running when this one was made, or 0
+};
+
+/// A function call, kept for error messages. It is only turned into text if there is an error.
+class CallStackEntry
+{
+public:
+    CallStackEntry(const Name &function, Source *source, int position)
+        : function(function), from(source, position, position) {}
+
+    Name function; ///< The function that was called
+    SourceSlice from; ///< Where it was called from (start is the position in the source)
+};
+
 class Interpreter {
 public:
     Interpreter();
@@ -317,6 +789,16 @@ public:
        \endcode
     */
     void addNative(const std::string &funcDesc, JSCallback ptr, void *userdata);
+    /** As above, but the native gets its arguments by position from a CallFrame, which
+        saves making a scope with a child for each parameter on every call:
+       \code
+           void scRandInt(CallFrame *c, void *userdata) {
+             int min = c->getArgument(0)->getInt(), max = c->getArgument(1)->getInt();
+             c->getReturnVar()->setInt(min + rand()%(1+max-min));
+           }
+       \endcode
+    */
+    void addNative(const std::string &funcDesc, JSNativeCallback ptr, void *userdata);
 
     /// get the given variable specified by a path (var1.var2.etc), or return 0
     Variable *getScriptVariable(const std::string &path) const;
@@ -328,18 +810,31 @@ public:
     /// Send all variables to stdout
     void trace();
 
+    /// Select how scripts are run (see INTERPRETER_ENGINES)
+    void setEngine(int engine);
+    int getEngine() const;
+
+    /// How much the pools of Variables and VariableLinks have allocated on this thread
+    void getPoolStats(PoolStats &variables, PoolStats &links) const;
+
     Variable *root;   /// root of symbol table
 private:
     Lexer *l;             /// current lexer
     std::vector<Variable*> scopes; /// stack of scopes when parsing
+    CallFrame *frame; /// the innermost function call being run, 0 at the top level
 #ifdef TINYJS_CALL_STACK
-    std::vector<std::string> call_stack; /// Names of places called so we can show when erroring
+    std::vector<CallStackEntry> call_stack; /// Functions called and where from, so we can show them when erroring
 #endif
 
     Variable *stringClass; /// Built in string class
     Variable *objectClass; /// Built in object class
     Variable *arrayClass; /// Built in array class
 
+    int engine; /// How scripts are run
+    CompiledCode *code; /// code currently being walked (when not ENGINE_LEGACY)
+    std::vector<VariableLink*> temporaries; /// links created while walking, freed at the end of each statement
+    bool returning; /// set by 'return' while walking, to unwind to the function call
+
     // parsing - in order of precedence
     VariableLink *functionCall(bool &execute, VariableLink *function, Variable *parent);
     VariableLink *factor(bool &execute);
@@ -356,10 +851,31 @@ private:
     // parsing utility functions
     VariableLink *parseFunctionDefinition();
     void parseFunctionArguments(Variable *funcVar);
-
-    VariableLink *findInScopes(const std::string &childName) const; ///< Finds a child, looking recursively up the scopes
+    Variable *addNativeFunction(const std::string &funcDesc); ///< Parse the description given to addNative, and add the function it describes
+
+    // tree walking - see TinyJS_AST.cpp
+    void executeCompiled(const std::string &code);
+    VariableLink evaluateCompiled(const std::string &code);
+    std::string getErrorMessage(Exception *e, const std::string &position) const;
+    VariableLink *temporary(Variable *var, const Name &name = Name());
+    void releaseTemporaries(size_t mark);
+    Variable *createFunction(Node *node);
+    CompiledCode *getFunctionCode(Variable *function);
+    VariableLink *getMember(VariableLink *object, const Name &name);
+    VariableLink *callFunction(VariableLink *function, Variable *parent, const std::vector<Node*> &arguments, Node *node);
+    VariableLink *callFunction(VariableLink *function, Variable *parent, VariableLink **arguments, int argumentCount, int position);
+    VariableLink *evaluateCall(Node *node);
+    VariableLink *evaluateNode(Node *node);
+    void evaluateDiscarded(Node *node); ///< Evaluate an expression whose value isn't used (so 'a++' can be done in place)
+    void runStatement(Node *node);
+    void repeatLoop(const SourceSlice &loop, bool &execute);
+    // bytecode - see TinyJS_VM.cpp
+    VariableLink *getRegisterLink(Value &reg); ///< The link in a VM register, moving a value held in the register itself into a temporary first
+    VariableLink *runBytecode(Bytecode *bytecode, int *errorPosition, VariableLink *thisLink = 0, VariableLink *parameters = 0, int parameterCount = 0);
+
+    VariableLink *findInScopes(const Name &childName) const; ///< Finds a child, looking recursively up the scopes
     /// Look up in any parent classes of the given object
-    VariableLink *findInParentClasses(Variable *object, const std::string &name) const;
+    VariableLink *findInParentClasses(Variable *object, const Name &name) const;
 };
 
 }; // namespace TinyJS
@@ -0,0 +1,1235 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Syntax tree, so code is only parsed once
+ *
+ * Authored By Gordon Williams <gw@pur3.co.uk>
+ * Additional Coding By Marco Lizza <marco.lizza@gmail.com>
+ *
+ * Copyright (C) 2009 Pur3 Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * The Interpreter normally runs scripts straight from the tokens, which means
+ * that function bodies and loops get lexed and parsed again every time they
+ * are run. Here the code is parsed once into a tree of Nodes, which is then
+ * walked as many times as needed.
+ *
+ * The tree walker keeps the semantics of statement/base/factor, including the
+ * way VariableLinks are shared and replaced. Temporary links are collected in
+ * Interpreter::temporaries and freed at the end of each statement, rather
+ * than being CLEANed one by one.
+ */
+
+#include "TinyJS_AST.h"
+#include "TinyJS_VM.h"
+#include <assert.h>
+#include <string.h>
+#include <sstream>
+#include <cstdlib>
+#include <stdio.h>
+
+#ifndef ASSERT
+  #define ASSERT(X) assert(X)
+#endif
+
+#ifdef __GNUC__
+  #define sprintf_s snprintf
+#endif
+
+#ifdef _WIN32_WCE
+  #include <strsafe.h>
+  #define sprintf_s StringCbPrintfA
+#endif
+
+namespace TinyJS {
+
+// ----------------------------------------------------------------------------------- NODE
+
+Node::Node(int type, int position) {
+    this->type = type;
+    this->op = 0;
+    this->position = position;
+    intValue = 0;
+    doubleValue = 0;
+    a = b = c = d = 0;
+    code = 0;
+}
+
+Node::~Node() {
+    delete a;
+    delete b;
+    delete c;
+    delete d;
+    for (size_t i=0;i<list.size();i++)
+      delete list[i];
+    if (code) code->unref();
+}
+
+// ----------------------------------------------------------------------------------- COMPILED CODE
+
+CompiledCode::CompiledCode(const std::string &text) {
+    Source *s = new Source(text);
+    source = SourceSlice(s, 0, s->length);
+    root = 0;
+    bytecode = 0;
+    refs = 0;
+}
+
+CompiledCode::CompiledCode(const SourceSlice &source)
+    : source(source) {
+    root = 0;
+    bytecode = 0;
+    refs = 0;
+}
+
+CompiledCode::~CompiledCode() {
+    delete bytecode;
+    delete root;
+}
+
+std::string CompiledCode::getPosition(int pos) const {
+    if (!source.source) return Lexer::formatPosition("", 0, pos);
+    return source.source->getPosition(pos);
+}
+
+CompiledCode *CompiledCode::ref() {
+    refs++;
+    return this;
+}
+
+void CompiledCode::unref() {
+    if ((--refs)==0)
+      delete this;
+}
+
+// ----------------------------------------------------------------------------------- PARSER
+
+Parser::Parser(const SourceSlice &source) {
+    l = new Lexer(source);
+}
+
+Parser::~Parser() {
+    delete l;
+}
+
+Node *Parser::node(int type) {
+    return new Node(type, l->tokenStart);
+}
+
+Node *Parser::node(int type, int op, Node *a, Node *b) {
+    Node *n = new Node(type, l->tokenStart);
+    n->op = op;
+    n->a = a;
+    n->b = b;
+    return n;
+}
+
+Node *Parser::parseProgram() {
+    Node *program = node(NODE_BLOCK);
+    try {
+        while (l->tk) program->list.push_back(statement());
+    } catch (Exception *e) {
+        delete program;
+        throw;
+    }
+    return program;
+}
+
+Node *Parser::parseExpressions() {
+    Node *expressions = node(NODE_BLOCK);
+    try {
+        do {
+          expressions->list.push_back(base());
+          if (l->tk!=LEXER_EOF) l->match(';');
+        } while (l->tk!=LEXER_EOF);
+    } catch (Exception *e) {
+        delete expressions;
+        throw;
+    }
+    return expressions;
+}
+
+Node *Parser::parseBody() {
+    return block();
+}
+
+Node *Parser::parseFunctionDefinition() {
+    Node *func = node(NODE_FUNCTION);
+    try {
+        l->match(LEXER_RESERVED_FUNCTION);
+        /* we can have functions without names */
+        if (l->tk==LEXER_ID) {
+          func->name = l->tkName;
+          l->match(LEXER_ID);
+        }
+        l->match('(');
+        while (l->tk!=')') {
+          func->names.push_back(l->tkName);
+          l->match(LEXER_ID);
+          if (l->tk!=')') l->match(',');
+        }
+        l->match(')');
+        /* The body is only skipped here, and gets parsed the first time the
+         * function is called - just as the interpreter only parses it then */
+        int funcBegin = l->tokenStart;
+        l->skipBlock();
+        func->code = (new CompiledCode(l->getSubSource(funcBegin)))->ref();
+    } catch (Exception *e) {
+        delete func;
+        throw;
+    }
+    return func;
+}
+
+void Parser::parseArguments(Node *call) {
+    l->match('(');
+    while (l->tk!=')') {
+      call->list.push_back(base());
+      if (l->tk!=')') l->match(',');
+    }
+    l->match(')');
+}
+
+Node *Parser::factor() {
+    if (l->tk=='(') {
+        l->match('(');
+        Node *a = base();
+        try {
+          l->match(')');
+        } catch (Exception *e) {
+          delete a;
+          throw;
+        }
+        return a;
+    }
+    if (l->tk==LEXER_RESERVED_TRUE) {
+        Node *a = node(NODE_TRUE);
+        l->match(LEXER_RESERVED_TRUE);
+        return a;
+    }
+    if (l->tk==LEXER_RESERVED_FALSE) {
+        Node *a = node(NODE_FALSE);
+        l->match(LEXER_RESERVED_FALSE);
+        return a;
+    }
+    if (l->tk==LEXER_RESERVED_NULL) {
+        Node *a = node(NODE_NULL);
+        l->match(LEXER_RESERVED_NULL);
+        return a;
+    }
+    if (l->tk==LEXER_RESERVED_UNDEFINED) {
+        Node *a = node(NODE_UNDEFINED);
+        l->match(LEXER_RESERVED_UNDEFINED);
+        return a;
+    }
+    if (l->tk==LEXER_ID) {
+        Node *a = node(NODE_ID);
+        a->name = l->tkName;
+        try {
+          l->match(LEXER_ID);
+          while (l->tk=='(' || l->tk=='.' || l->tk=='[') {
+            if (l->tk=='(') { // ------------------------------------- Function Call
+              a = node(NODE_CALL, '(', a);
+              parseArguments(a);
+            } else if (l->tk == '.') { // ------------------------------------- Record Access
+              l->match('.');
+              a = node(NODE_MEMBER, '.', a);
+              a->name = l->tkName;
+              l->match(LEXER_ID);
+            } else if (l->tk == '[') { // ------------------------------------- Array Access
+              l->match('[');
+              a = node(NODE_INDEX, '[', a);
+              a->b = base();
+              l->match(']');
+            } else ASSERT(0);
+          }
+        } catch (Exception *e) {
+          delete a;
+          throw;
+        }
+        return a;
+    }
+    if (l->tk==LEXER_INT) {
+        Node *a = node(NODE_INT);
+        a->intValue = l->getToken().intValue;
+        l->match(LEXER_INT);
+        return a;
+    }
+    if (l->tk==LEXER_FLOAT) {
+        Node *a = node(NODE_DOUBLE);
+        a->doubleValue = l->getToken().floatValue;
+        l->match(LEXER_FLOAT);
+        return a;
+    }
+    if (l->tk==LEXER_STR) {
+        Node *a = node(NODE_STRING);
+        a->name = l->tkName;
+        l->match(LEXER_STR);
+        return a;
+    }
+    if (l->tk=='{') {
+        /* JSON-style object definition */
+        Node *contents = node(NODE_OBJECT);
+        try {
+          l->match('{');
+          while (l->tk != '}') {
+            contents->names.push_back(l->tkName);
+            // we only allow strings or IDs on the left hand side of an initialisation
+            if (l->tk==LEXER_STR) l->match(LEXER_STR);
+            else l->match(LEXER_ID);
+            l->match(':');
+            contents->list.push_back(base());
+            if (l->tk != '}') l->match(',');
+          }
+          l->match('}');
+        } catch (Exception *e) {
+          delete contents;
+          throw;
+        }
+        return contents;
+    }
+    if (l->tk=='[') {
+        /* JSON-style array */
+        Node *contents = node(NODE_ARRAY);
+        try {
+          l->match('[');
+          while (l->tk != ']') {
+            contents->list.push_back(base());
+            if (l->tk != ']') l->match(',');
+          }
+          l->match(']');
+        } catch (Exception *e) {
+          delete contents;
+          throw;
+        }
+        return contents;
+    }
+    if (l->tk==LEXER_RESERVED_FUNCTION) {
+        Node *funcVar = parseFunctionDefinition();
+        if (funcVar->name != TINYJS_TEMP_NAME)
+          TRACE("Functions not defined at statement-level are not meant to have a name");
+        return funcVar;
+    }
+    if (l->tk==LEXER_RESERVED_NEW) {
+        // new -> create a new object
+        Node *a = node(NODE_NEW);
+        try {
+          l->match(LEXER_RESERVED_NEW);
+          a->name = l->tkName;
+          l->match(LEXER_ID);
+          if (l->tk == '(')
+            parseArguments(a);
+        } catch (Exception *e) {
+          delete a;
+          throw;
+        }
+        return a;
+    }
+    // Nothing we can do here... just hope it's the end...
+    Node *a = node(NODE_UNDEFINED);
+    try {
+      l->match(LEXER_EOF);
+    } catch (Exception *e) {
+      delete a;
+      throw;
+    }
+    return a;
+}
+
+Node *Parser::unary() {
+    if (l->tk=='!') {
+        Node *a = node(NODE_NOT, '!', 0);
+        l->match('!'); // binary not
+        try {
+          a->a = factor();
+        } catch (Exception *e) {
+          delete a;
+          throw;
+        }
+        return a;
+    }
+    return factor();
+}
+
+Node *Parser::term() {
+    Node *a = unary();
+    try {
+      while (l->tk=='*' || l->tk=='/' || l->tk=='%') {
+        a = node(NODE_BINARY, l->tk, a);
+        l->match(l->tk);
+        a->b = unary();
+      }
+    } catch (Exception *e) {
+      delete a;
+      throw;
+    }
+    return a;
+}
+
+Node *Parser::expression() {
+    Node *negate = 0;
+    if (l->tk=='-') {
+        negate = node(NODE_NEGATE, '-', 0);
+        l->match('-');
+    }
+    Node *a = 0;
+    try {
+      a = term();
+      if (negate) {
+        negate->a = a;
+        a = negate;
+        negate = 0;
+      }
+      while (l->tk=='+' || l->tk=='-' ||
+             l->tk==LEXER_PLUSPLUS || l->tk==LEXER_MINUSMINUS) {
+        int op = l->tk;
+        if (op==LEXER_PLUSPLUS || op==LEXER_MINUSMINUS) {
+          a = node(NODE_POSTFIX, op, a);
+          l->match(op);
+        } else {
+          a = node(NODE_BINARY, op, a);
+          l->match(op);
+          a->b = term();
+        }
+      }
+    } catch (Exception *e) {
+      delete negate;
+      delete a;
+      throw;
+    }
+    return a;
+}
+
+Node *Parser::shift() {
+    Node *a = expression();
+    if (l->tk==LEXER_LSHIFT || l->tk==LEXER_RSHIFT || l->tk==LEXER_RSHIFTUNSIGNED) {
+      a = node(NODE_SHIFT, l->tk, a);
+      try {
+        l->match(l->tk);
+        a->b = base();
+      } catch (Exception *e) {
+        delete a;
+        throw;
+      }
+    }
+    return a;
+}
+
+Node *Parser::condition() {
+    Node *a = shift();
+    try {
+      while (l->tk==LEXER_EQUAL || l->tk==LEXER_NEQUAL ||
+             l->tk==LEXER_TYPEEQUAL || l->tk==LEXER_NTYPEEQUAL ||
+             l->tk==LEXER_LEQUAL || l->tk==LEXER_GEQUAL ||
+             l->tk=='<' || l->tk=='>') {
+        a = node(NODE_BINARY, l->tk, a);
+        l->match(l->tk);
+        a->b = shift();
+      }
+    } catch (Exception *e) {
+      delete a;
+      throw;
+    }
+    return a;
+}
+
+Node *Parser::logic() {
+    Node *a = condition();
+    try {
+      while (l->tk=='&' || l->tk=='|' || l->tk=='^' || l->tk==LEXER_ANDAND || l->tk==LEXER_OROR) {
+        int op = l->tk;
+        // short-circuit ops only evaluate the right hand side if they need it
+        a = node((op==LEXER_ANDAND || op==LEXER_OROR) ? NODE_LOGIC : NODE_BINARY, op, a);
+        l->match(op);
+        a->b = condition();
+      }
+    } catch (Exception *e) {
+      delete a;
+      throw;
+    }
+    return a;
+}
+
+Node *Parser::ternary() {
+    Node *a = logic();
+    if (l->tk=='?') {
+      a = node(NODE_TERNARY, '?', a);
+      try {
+        l->match('?');
+        a->b = base();
+        l->match(':');
+        a->c = base();
+      } catch (Exception *e) {
+        delete a;
+        throw;
+      }
+    }
+    return a;
+}
+
+Node *Parser::base() {
+    Node *a = ternary();
+    if (l->tk=='=' || l->tk==LEXER_PLUSEQUAL || l->tk==LEXER_MINUSEQUAL) {
+      a = node(NODE_ASSIGN, l->tk, a);
+      try {
+        l->match(l->tk);
+        a->b = base();
+      } catch (Exception *e) {
+        delete a;
+        throw;
+      }
+    }
+    return a;
+}
+
+Node *Parser::block() {
+    Node *a = node(NODE_BLOCK);
+    try {
+      l->match('{');
+      while (l->tk && l->tk!='}')
+        a->list.push_back(statement());
+      l->match('}');
+    } catch (Exception *e) {
+      delete a;
+      throw;
+    }
+    return a;
+}
+
+Node *Parser::statement() {
+    if (l->tk==LEXER_ID ||
+        l->tk==LEXER_INT ||
+        l->tk==LEXER_FLOAT ||
+        l->tk==LEXER_STR ||
+        l->tk=='-') {
+        /* A simple statement that only contains basic arithmetic... */
+        Node *a = node(NODE_EXPRESSION);
+        try {
+          a->a = base();
+          l->match(';');
+        } catch (Exception *e) {
+          delete a;
+          throw;
+        }
+        return a;
+    }
+    if (l->tk=='{') {
+        /* A block of code */
+        return block();
+    }
+    if (l->tk==';') {
+        /* Empty statement - to allow things like ;;; */
+        Node *a = node(NODE_EMPTY);
+        l->match(';');
+        return a;
+    }
+    Node *a = 0;
+    try {
+      if (l->tk==LEXER_RESERVED_VAR) {
+        a = node(NODE_VAR);
+        l->match(LEXER_RESERVED_VAR);
+        while (l->tk != ';') {
+          Node *declaration = node(NODE_DECLARATION);
+          a->list.push_back(declaration);
+          declaration->names.push_back(l->tkName);
+          l->match(LEXER_ID);
+          // now do stuff defined with dots
+          while (l->tk == '.') {
+            l->match('.');
+            declaration->names.push_back(l->tkName);
+            l->match(LEXER_ID);
+          }
+          // sort out initialiser
+          if (l->tk == '=') {
+            l->match('=');
+            declaration->a = base();
+          }
+          if (l->tk != ';')
+            l->match(',');
+        }
+        l->match(';');
+      } else if (l->tk==LEXER_RESERVED_IF) {
+        a = node(NODE_IF);
+        l->match(LEXER_RESERVED_IF);
+        l->match('(');
+        a->a = base();
+        l->match(')');
+        a->b = statement();
+        if (l->tk==LEXER_RESERVED_ELSE) {
+          l->match(LEXER_RESERVED_ELSE);
+          a->c = statement();
+        }
+      } else if (l->tk==LEXER_RESERVED_WHILE) {
+        a = node(NODE_WHILE);
+        l->match(LEXER_RESERVED_WHILE);
+        l->match('(');
+        a->a = base();
+        l->match(')');
+        a->b = statement();
+      } else if (l->tk==LEXER_RESERVED_FOR) {
+        a = node(NODE_FOR);
+        l->match(LEXER_RESERVED_FOR);
+        l->match('(');
+        a->a = statement(); // initialisation
+        a->b = base(); // condition
+        l->match(';');
+        a->c = base(); // iterator
+        l->match(')');
+        a->d = statement();
+      } else if (l->tk==LEXER_RESERVED_RETURN) {
+        a = node(NODE_RETURN);
+        l->match(LEXER_RESERVED_RETURN);
+        if (l->tk != ';')
+          a->a = base();
+        l->match(';');
+      } else if (l->tk==LEXER_RESERVED_FUNCTION) {
+        a = node(NODE_DEFINE);
+        a->a = parseFunctionDefinition();
+      } else {
+        a = node(NODE_EMPTY);
+        l->match(LEXER_EOF);
+      }
+    } catch (Exception *e) {
+      delete a;
+      throw;
+    }
+    return a;
+}
+
+// ----------------------------------------------------------------------------------- INTERPRETER
+
+void Interpreter::executeCompiled(const std::string &source) {
+    CompiledCode *oldCode = code;
+    std::vector<Variable*> oldScopes = scopes;
+    CallFrame *oldFrame = frame;
+    bool oldReturning = returning;
+    size_t mark = temporaries.size();
+
+    CompiledCode *script = (new CompiledCode(source))->ref();
+    Parser parser(script->source);
+    int errorPosition = -1;
+    code = script;
+#ifdef TINYJS_CALL_STACK
+    call_stack.clear();
+#endif
+    scopes.clear();
+    scopes.push_back(root);
+    frame = 0;
+    returning = false;
+    try {
+        script->root = parser.parseProgram();
+        if (engine == ENGINE_VM) {
+          script->bytecode = new Bytecode();
+          Compiler compiler(script->bytecode);
+          compiler.compileProgram(script->root);
+          runBytecode(script->bytecode, &errorPosition);
+        } else {
+          for (size_t i=0;i<script->root->list.size() && !returning;i++) {
+            Node *statement = script->root->list[i];
+            errorPosition = statement->position;
+            runStatement(statement);
+          }
+        }
+    } catch (Exception *e) {
+        std::string msg = getErrorMessage(e,
+            errorPosition>=0 ? script->getPosition(errorPosition) : parser.l->getPosition());
+        delete e;
+        releaseTemporaries(mark);
+        code = oldCode;
+        returning = oldReturning;
+        frame = oldFrame;
+        script->unref();
+
+        throw new Exception(msg);
+    }
+    code = oldCode;
+    returning = oldReturning;
+    script->unref();
+    scopes = oldScopes;
+    frame = oldFrame;
+}
+
+VariableLink Interpreter::evaluateCompiled(const std::string &source) {
+    CompiledCode *oldCode = code;
+    std::vector<Variable*> oldScopes = scopes;
+    CallFrame *oldFrame = frame;
+    bool oldReturning = returning;
+    size_t mark = temporaries.size();
+
+    CompiledCode *script = (new CompiledCode(source))->ref();
+    Parser parser(script->source);
+    int errorPosition = -1;
+    VariableLink *v = 0;
+    code = script;
+#ifdef TINYJS_CALL_STACK
+    call_stack.clear();
+#endif
+    scopes.clear();
+    scopes.push_back(root);
+    frame = 0;
+    returning = false;
+    try {
+        script->root = parser.parseExpressions();
+        if (engine == ENGINE_VM) {
+          script->bytecode = new Bytecode();
+          Compiler compiler(script->bytecode);
+          compiler.compileExpressions(script->root);
+          v = runBytecode(script->bytecode, &errorPosition);
+        } else {
+          for (size_t i=0;i<script->root->list.size();i++) {
+            // only the value of the last expression is kept
+            releaseTemporaries(mark);
+            Node *expression = script->root->list[i];
+            errorPosition = expression->position;
+            v = evaluateNode(expression);
+          }
+        }
+    } catch (Exception *e) {
+        std::string msg = getErrorMessage(e,
+            errorPosition>=0 ? script->getPosition(errorPosition) : parser.l->getPosition());
+        delete e;
+        releaseTemporaries(mark);
+        code = oldCode;
+        returning = oldReturning;
+        frame = oldFrame;
+        script->unref();
+
+        throw new Exception(msg);
+    }
+    VariableLink r = v ? VariableLink(*v) : VariableLink(new Variable());
+    releaseTemporaries(mark);
+    code = oldCode;
+    returning = oldReturning;
+    script->unref();
+    scopes = oldScopes;
+    frame = oldFrame;
+    return r;
+}
+
+/** Run the rest of a 'while' or 'for' loop for ENGINE_LEGACY, once it has been round
+ * once from the tokens (for a 'for' loop, up to but not including the iterator).
+ * Instead of re-lexing the condition, iterator and body every time round, the loop is
+ * parsed once and its syntax tree walked. A 'return' in the body clears 'execute'.
+ */
+void Interpreter::repeatLoop(const SourceSlice &loop, bool &execute) {
+    CompiledCode *oldCode = code;
+    size_t mark = temporaries.size();
+    CompiledCode *loopCode = (new CompiledCode(loop))->ref();
+    Parser parser(loopCode->source);
+    int loopCount = TINYJS_LOOP_MAX_ITERATIONS;
+    bool isWhile = true;
+    code = loopCode;
+    try {
+      loopCode->root = parser.parseProgram();
+      Node *node = loopCode->root->list[0];
+      isWhile = node->type == NODE_WHILE;
+      Node *cond = isWhile ? node->a : node->b;
+      Node *body = isWhile ? node->b : node->d;
+      bool loopCond = true;
+      if (!isWhile) {
+        evaluateDiscarded(node->c);
+        releaseTemporaries(mark);
+      }
+      while (loopCond && loopCount-->0) {
+        loopCond = evaluateNode(cond)->var->getBool();
+        releaseTemporaries(mark);
+        if (loopCond) {
+          runStatement(body);
+          if (returning) {
+            loopCond = false;
+          } else if (!isWhile) {
+            evaluateDiscarded(node->c);
+            releaseTemporaries(mark);
+          }
+        }
+      }
+    } catch (Exception *e) {
+      releaseTemporaries(mark);
+      returning = false;
+      code = oldCode;
+      loopCode->unref();
+      throw;
+    }
+    if (returning) {
+      returning = false;
+      execute = false;
+    }
+    code = oldCode;
+    loopCode->unref();
+    if (loopCount<=0) {
+      root->trace();
+      TRACE("%s Loop exceeded %d iterations at %s\n", isWhile ? "WHILE" : "FOR", TINYJS_LOOP_MAX_ITERATIONS, l->getPosition().c_str());
+      throw new Exception("LOOP_ERROR");
+    }
+}
+
+VariableLink *Interpreter::temporary(Variable *var, const Name &name) {
+    VariableLink *link = new VariableLink(var, name);
+    temporaries.push_back(link);
+    return link;
+}
+
+void Interpreter::releaseTemporaries(size_t mark) {
+    while (temporaries.size() > mark) {
+      VariableLink *link = temporaries.back();
+      temporaries.pop_back();
+      delete link;
+    }
+}
+
+Variable *Interpreter::createFunction(Node *node) {
+    Variable *funcVar = new Variable(TINYJS_BLANK_DATA, VARIABLE_FUNCTION);
+    for (size_t i=0;i<node->names.size();i++)
+      funcVar->addChildNoDup(node->names[i]);
+    // keep the source too, so the legacy engine and getJSON still work
+    funcVar->functionData->code = node->code->source;
+    funcVar->functionData->compiled = node->code->ref();
+    return funcVar;
+}
+
+CompiledCode *Interpreter::getFunctionCode(Variable *function) {
+    // functions defined by the legacy engine only have their source
+    FunctionData *data = function->functionData;
+    if (!data->compiled)
+      data->compiled = (new CompiledCode(data->code))->ref();
+    if (!data->compiled->root) {
+      Parser parser(data->compiled->source);
+      data->compiled->root = parser.parseBody();
+    }
+    if (engine == ENGINE_VM && !data->compiled->bytecode) {
+      Bytecode *bytecode = new Bytecode();
+      std::vector<std::string> parameters;
+      for (VariableLink *v = function->firstChild; v; v = v->nextSibling)
+        parameters.push_back(v->name);
+      Compiler compiler(bytecode);
+      compiler.compileBody(data->compiled->root, parameters);
+      data->compiled->bytecode = bytecode;
+    }
+    return data->compiled;
+}
+
+VariableLink *Interpreter::getMember(VariableLink *object, const Name &name) {
+    VariableLink *child = object->var->findChild(name);
+    if (!child) child = findInParentClasses(object->var, name);
+    if (!child) {
+      /* if we haven't found this defined yet, use the built-in
+         'length' properly */
+      if (object->var->isArray() && name == "length") {
+        int l = object->var->getArrayLength();
+        child = temporary(new Variable(l));
+      } else if (object->var->isString() && name == "length") {
+        int l = object->var->getStringLength();
+        child = temporary(new Variable(l));
+      } else {
+        object->copyIfConstant();
+        child = object->var->addChild(name);
+      }
+    }
+    return child;
+}
+
+/** Call a function with the given (unevaluated) arguments. 'parent' is the object
+ * that contains this method, if there was one (otherwise it's just a normal function).
+ */
+VariableLink *Interpreter::callFunction(VariableLink *function, Variable *parent, const std::vector<Node*> &arguments, Node *node) {
+    if (!function->var->isFunction()) {
+      std::ostringstream msg;
+      msg << "Expecting '" << function->name.str() << "' to be a function";
+      throw new Exception(msg.str());
+    }
+    std::vector<VariableLink*> values(arguments.size());
+    for (size_t i=0;i<arguments.size();i++) {
+      VariableLink *value = evaluateNode(arguments[i]);
+      // pass basic values by value, so later arguments can't change them
+      values[i] = value->var->isBasic() ? temporary(value->var->deepCopy()) : value;
+    }
+    return callFunction(function, parent, values.empty() ? 0 : &values[0], (int)values.size(), node->position);
+}
+
+/** Call a function with arguments that have already been evaluated (and copied, if they
+ * are passed by value). 'position' is where the call is in the code being run.
+ */
+VariableLink *Interpreter::callFunction(VariableLink *function, Variable *parent, VariableLink **arguments, int argumentCount, int position) {
+    CallFrame callFrame(function->var, parent, arguments, argumentCount, frame);
+    FunctionData *functionData = function->var->functionData;
+    if (functionData->jsNativeCallback) {
+      // it gets the arguments from the frame, so there's no scope to make
+#ifdef TINYJS_CALL_STACK
+      call_stack.push_back(CallStackEntry(function->name, code->source.source, position));
+#endif
+      functionData->jsNativeCallback(&callFrame, functionData->jsCallbackUserData);
+#ifdef TINYJS_CALL_STACK
+      if (!call_stack.empty()) call_stack.pop_back();
+#endif
+      return temporary(callFrame.getResult());
+    }
+    // create a new symbol table entry for execution of this function
+    Variable *functionRoot = (new Variable(TINYJS_BLANK_DATA, VARIABLE_FUNCTION))->ref();
+    CompiledCode *oldCode = code;
+    CompiledCode *functionCode = 0;
+    bool pushed = false;
+    try {
+      VariableLink *thisLink = 0;
+      if (parent)
+        thisLink = functionRoot->addChildNoDup(Name::getThis(), parent);
+      // grab in all parameters, missing ones are left undefined
+      VariableLink *parameters = 0;
+      int i = 0;
+      for (VariableLink *v = function->var->firstChild; v; v = v->nextSibling, i++) {
+        VariableLink *parameter;
+        if (i < argumentCount)
+          parameter = functionRoot->addChild(v->name, arguments[i]->var);
+        else
+          parameter = functionRoot->addChild(v->name);
+        if (!parameters) parameters = parameter;
+      }
+      // add the function's execute space to the symbol table so we can recurse
+      scopes.push_back(functionRoot);
+      frame = &callFrame;
+      pushed = true;
+#ifdef TINYJS_CALL_STACK
+      call_stack.push_back(CallStackEntry(function->name, code->source.source, position));
+#endif
+
+      if (function->var->isNative()) {
+        ASSERT(functionData->jsCallback);
+        functionData->jsCallback(functionRoot, functionData->jsCallbackUserData);
+        // natives using the old API leave the result in a child
+        VariableLink *returnVarLink = functionRoot->findChild(Name::getReturn());
+        if (returnVarLink) callFrame.setReturnVar(returnVarLink->var);
+      } else {
+        // hold the code, as the function could get replaced while it runs
+        functionCode = getFunctionCode(function->var)->ref();
+        code = functionCode;
+        if (engine == ENGINE_VM)
+          runBytecode(functionCode->bytecode, 0, thisLink, parameters, i);
+        else
+          runStatement(functionCode->root);
+        returning = false;
+        code = oldCode;
+        functionCode->unref();
+      }
+#ifdef TINYJS_CALL_STACK
+      if (!call_stack.empty()) call_stack.pop_back();
+#endif
+      scopes.pop_back();
+      frame = callFrame.caller;
+      functionRoot->unref();
+      return temporary(callFrame.getResult());
+    } catch (Exception *e) {
+      // leave the call stack alone, so it can be reported
+      if (functionCode) {
+        code = oldCode;
+        functionCode->unref();
+      }
+      if (pushed) {
+        scopes.pop_back();
+        frame = callFrame.caller;
+      }
+      functionRoot->unref();
+      throw;
+    }
+}
+
+VariableLink *Interpreter::evaluateCall(Node *node) {
+    Node *callee = node->a;
+    Variable *parent = 0;
+    VariableLink *function;
+    if (callee->type == NODE_MEMBER) {
+      VariableLink *object = evaluateNode(callee->a);
+      function = getMember(object, callee->name);
+      parent = object->var;
+    } else if (callee->type == NODE_INDEX) {
+      VariableLink *object = evaluateNode(callee->a);
+      VariableLink *index = evaluateNode(callee->b);
+      char buffer[TINYJS_NUMBER_BUFFER];
+      object->copyIfConstant();
+      function = object->var->findChildOrCreate(index->var->getStringView(buffer));
+      parent = object->var;
+    } else
+      function = evaluateNode(callee);
+    return callFunction(function, parent, node->list, node);
+}
+
+VariableLink *Interpreter::evaluateNode(Node *node) {
+    switch (node->type) {
+      case NODE_INT:
+        return temporary(Variable::getIntValue(node->intValue));
+      case NODE_DOUBLE:
+        return temporary(new Variable(node->doubleValue));
+      case NODE_STRING: {
+        Variable *a = new Variable(TINYJS_BLANK_DATA, VARIABLE_STRING);
+        a->setStringLiteral(node->name);
+        return temporary(a);
+      }
+      case NODE_TRUE:
+        return temporary(Variable::getBoolValue(true));
+      case NODE_FALSE:
+        return temporary(Variable::getBoolValue(false));
+      case NODE_NULL:
+        return temporary(Variable::getNullValue());
+      case NODE_UNDEFINED:
+        return temporary(Variable::getUndefinedValue());
+      case NODE_ID: {
+        VariableLink *a = findInScopes(node->name);
+        /* Variable doesn't exist! JavaScript says we should create it
+         * (we won't add it here. This is done in the assignment operator)*/
+        if (!a) a = temporary(new Variable(), node->name);
+        return a;
+      }
+      case NODE_MEMBER:
+        return getMember(evaluateNode(node->a), node->name);
+      case NODE_INDEX: {
+        VariableLink *a = evaluateNode(node->a);
+        VariableLink *index = evaluateNode(node->b);
+        VariableLink *element = a->var->getElement(index->var);
+        if (element) return element;
+        char buffer[TINYJS_NUMBER_BUFFER];
+        a->copyIfConstant();
+        return a->var->findChildOrCreate(index->var->getStringView(buffer));
+      }
+      case NODE_CALL:
+        return evaluateCall(node);
+      case NODE_NEW: {
+        VariableLink *objClassOrFunc = findInScopes(node->name);
+        if (!objClassOrFunc) {
+          TRACE("%s is not a valid class name", node->name.str().c_str());
+          return temporary(new Variable());
+        }
+        Variable *obj = new Variable(TINYJS_BLANK_DATA, VARIABLE_OBJECT);
+        VariableLink *objLink = temporary(obj);
+        if (objClassOrFunc->var->isFunction()) {
+          callFunction(objClassOrFunc, obj, node->list, node);
+        } else {
+          obj->addChild(Name::getPrototype(), objClassOrFunc->var);
+        }
+        return objLink;
+      }
+      case NODE_OBJECT: {
+        VariableLink *contents = temporary(new Variable(TINYJS_BLANK_DATA, VARIABLE_OBJECT));
+        for (size_t i=0;i<node->list.size();i++)
+          contents->var->addChild(node->names[i], evaluateNode(node->list[i])->var);
+        return contents;
+      }
+      case NODE_ARRAY: {
+        VariableLink *contents = temporary(new Variable(TINYJS_BLANK_DATA, VARIABLE_ARRAY));
+        for (size_t i=0;i<node->list.size();i++) {
+          char idx_str[TINYJS_NUMBER_BUFFER];
+          formatInteger(idx_str, (long)i);
+          contents->var->addChild(idx_str, evaluateNode(node->list[i])->var);
+        }
+        return contents;
+      }
+      case NODE_FUNCTION:
+        return temporary(createFunction(node), node->name);
+      case NODE_NOT:
+        return temporary(evaluateNode(node->a)->var->unaryOp('!'));
+      case NODE_NEGATE:
+        return temporary(evaluateNode(node->a)->var->unaryOp('-'));
+      case NODE_BINARY: {
+        VariableLink *a = evaluateNode(node->a);
+        VariableLink *b = evaluateNode(node->b);
+        return temporary(a->var->mathsOp(b->var, node->op));
+      }
+      case NODE_POSTFIX: {
+        VariableLink *a = evaluateNode(node->a);
+        int op = node->op==LEXER_PLUSPLUS ? '+' : '-';
+        NumericValue value;
+        Variable *res;
+        if (a->var->getNumeric(value)) {
+          NumericValue::maths(value, NumericValue(1), op, value);
+          res = new Variable(value);
+        } else {
+          Variable one(1);
+          res = a->var->mathsOp(&one, op);
+        }
+        VariableLink *oldValue = temporary(a->var);
+        // in-place add/subtract
+        a->replaceWith(res);
+        return oldValue;
+      }
+      case NODE_SHIFT: {
+        int value = evaluateNode(node->a)->var->getInt();
+        int shift = evaluateNode(node->b)->var->getInt();
+        if (node->op==LEXER_LSHIFT) value = value << shift;
+        if (node->op==LEXER_RSHIFT) value = value >> shift;
+        if (node->op==LEXER_RSHIFTUNSIGNED) value = ((unsigned int)value) >> shift;
+        return temporary(Variable::getIntValue(value));
+      }
+      case NODE_LOGIC: {
+        VariableLink *a = evaluateNode(node->a);
+        // if we know the outcome we don't bother to evaluate the other side
+        bool shortCircuit = (node->op==LEXER_ANDAND) ? !a->var->getBool() : a->var->getBool();
+        if (shortCircuit) return a;
+        VariableLink *b = evaluateNode(node->b);
+        Variable newa(a->var->getBool());
+        Variable newb(b->var->getBool());
+        return temporary(newa.mathsOp(&newb, node->op==LEXER_ANDAND ? '&' : '|'));
+      }
+      case NODE_TERNARY:
+        if (evaluateNode(node->a)->var->getBool())
+          return evaluateNode(node->b);
+        else
+          return evaluateNode(node->c);
+      case NODE_ASSIGN: {
+        VariableLink *lhs = evaluateNode(node->a);
+        /* If we're assigning to this and we don't have a parent,
+         * add it to the symbol table root as per JavaScript. */
+        if (!lhs->owned) {
+          if (!lhs->name.empty())
+            lhs = root->addChildNoDup(lhs->name, lhs->var);
+          else
+            TRACE("Trying to assign to an un-named type\n");
+        }
+        VariableLink *rhs = evaluateNode(node->b);
+        if (node->op=='=') {
+          lhs->replaceWith(rhs);
+        } else if (node->op==LEXER_PLUSEQUAL || node->op==LEXER_MINUSEQUAL) {
+          int op = node->op==LEXER_PLUSEQUAL ? '+' : '-';
+          if (!lhs->var->mathsOpInPlace(rhs->var, op))
+            lhs->replaceWith(lhs->var->mathsOp(rhs->var, op));
+        } else ASSERT(0);
+        return lhs;
+      }
+      default:
+        ASSERT(0);
+        return 0;
+    }
+}
+
+void Interpreter::evaluateDiscarded(Node *node) {
+    if (node->type != NODE_POSTFIX) {
+      evaluateNode(node);
+      return;
+    }
+    // nobody needs the old value, so we can add/subtract in place
+    VariableLink *a = evaluateNode(node->a);
+    int op = node->op==LEXER_PLUSPLUS ? '+' : '-';
+    if (!a->var->mathsOpInPlace(NumericValue(1), op)) {
+      Variable one(1);
+      a->replaceWith(a->var->mathsOp(&one, op));
+    }
+}
+
+void Interpreter::runStatement(Node *node) {
+    size_t mark = temporaries.size();
+    switch (node->type) {
+      case NODE_EMPTY:
+        break;
+      case NODE_BLOCK:
+        for (size_t i=0;i<node->list.size() && !returning;i++)
+          runStatement(node->list[i]);
+        break;
+      case NODE_EXPRESSION:
+        evaluateDiscarded(node->a);
+        break;
+      case NODE_VAR:
+        for (size_t i=0;i<node->list.size();i++) {
+          Node *declaration = node->list[i];
+          VariableLink *a = scopes.back()->findChildOrCreate(declaration->names[0]);
+          // now do stuff defined with dots
+          for (size_t n=1;n<declaration->names.size();n++)
+            a = a->var->findChildOrCreate(declaration->names[n]);
+          // sort out initialiser
+          if (declaration->a)
+            a->replaceWith(evaluateNode(declaration->a));
+          releaseTemporaries(mark);
+        }
+        break;
+      case NODE_IF: {
+        bool cond = evaluateNode(node->a)->var->getBool();
+        releaseTemporaries(mark);
+        if (cond)
+          runStatement(node->b);
+        else if (node->c)
+          runStatement(node->c);
+      } break;
+      case NODE_WHILE: {
+        bool loopCond = evaluateNode(node->a)->var->getBool();
+        releaseTemporaries(mark);
+        if (loopCond)
+          runStatement(node->b);
+        int loopCount = TINYJS_LOOP_MAX_ITERATIONS;
+        while (loopCond && loopCount-->0) {
+          // a 'return' in the body ends the loop
+          loopCond = !returning && evaluateNode(node->a)->var->getBool();
+          releaseTemporaries(mark);
+          if (loopCond)
+            runStatement(node->b);
+        }
+        if (loopCount<=0) {
+          root->trace();
+          TRACE("WHILE Loop exceeded %d iterations at %s\n", TINYJS_LOOP_MAX_ITERATIONS, code->getPosition(node->position).c_str());
+          throw new Exception("LOOP_ERROR");
+        }
+      } break;
+      case NODE_FOR: {
+        runStatement(node->a); // initialisation
+        bool loopCond = evaluateNode(node->b)->var->getBool();
+        releaseTemporaries(mark);
+        if (loopCond)
+          runStatement(node->d);
+        if (loopCond && !returning) {
+          evaluateDiscarded(node->c);
+          releaseTemporaries(mark);
+        }
+        int loopCount = TINYJS_LOOP_MAX_ITERATIONS;
+        while (!returning && loopCond && loopCount-->0) {
+          loopCond = evaluateNode(node->b)->var->getBool();
+          releaseTemporaries(mark);
+          if (loopCond)
+            runStatement(node->d);
+          if (loopCond && !returning) {
+            evaluateDiscarded(node->c);
+            releaseTemporaries(mark);
+          }
+        }
+        if (loopCount<=0) {
+          root->trace();
+          TRACE("FOR Loop exceeded %d iterations at %s\n", TINYJS_LOOP_MAX_ITERATIONS, code->getPosition(node->position).c_str());
+          throw new Exception("LOOP_ERROR");
+        }
+      } break;
+      case NODE_RETURN: {
+        VariableLink *result = node->a ? evaluateNode(node->a) : 0;
+        if (frame)
+          frame->setReturnVar(result ? result->var : 0);
+        else
+          TRACE("RETURN statement, but not in a function.\n");
+        returning = true;
+      } break;
+      case NODE_DEFINE: {
+        Node *func = node->a;
+        if (func->name == TINYJS_TEMP_NAME)
+          TRACE("Functions defined at statement-level are meant to have a name\n");
+        else
+          scopes.back()->addChildNoDup(func->name, createFunction(func));
+      } break;
+      default:
+        ASSERT(0);
+    }
+    releaseTemporaries(mark);
+}
+
+}; // namespace TinyJS
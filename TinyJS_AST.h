@@ -0,0 +1,154 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Syntax tree, so code is only parsed once
+ *
+ * Authored By Gordon Williams <gw@pur3.co.uk>
+ * Additional Coding By Marco Lizza <marco.lizza@gmail.com>
+ *
+ * Copyright (C) 2009 Pur3 Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TINYJS_AST_H
+#define TINYJS_AST_H
+
+#include "TinyJS.h"
+
+namespace TinyJS {
+
+class Bytecode;
+
+enum NODE_TYPES {
+    // statements
+    NODE_EMPTY,
+    NODE_BLOCK,       ///< list = statements
+    NODE_EXPRESSION,  ///< a = expression
+    NODE_VAR,         ///< list = NODE_DECLARATIONs
+    NODE_DECLARATION, ///< names = dotted path, a = initialiser (may be 0)
+    NODE_IF,          ///< a = condition, b = then, c = else (may be 0)
+    NODE_WHILE,       ///< a = condition, b = body
+    NODE_FOR,         ///< a = initialisation, b = condition, c = iterator, d = body
+    NODE_RETURN,      ///< a = result (may be 0)
+    NODE_DEFINE,      ///< a = NODE_FUNCTION to add to the current scope
+    // expressions
+    NODE_INT,         ///< intValue
+    NODE_DOUBLE,      ///< doubleValue
+    NODE_STRING,      ///< name = contents
+    NODE_TRUE,
+    NODE_FALSE,
+    NODE_NULL,
+    NODE_UNDEFINED,
+    NODE_ID,          ///< name
+    NODE_MEMBER,      ///< a.name
+    NODE_INDEX,       ///< a[b]
+    NODE_CALL,        ///< a(list)
+    NODE_NEW,         ///< new name(list)
+    NODE_OBJECT,      ///< { names[i] : list[i] }
+    NODE_ARRAY,       ///< [ list ]
+    NODE_FUNCTION,    ///< function name(names) code
+    NODE_NOT,         ///< !a
+    NODE_NEGATE,      ///< -a
+    NODE_BINARY,      ///< a op b, done with Variable::mathsOp
+    NODE_POSTFIX,     ///< a++ or a--
+    NODE_SHIFT,       ///< a << b, a >> b, a >>> b
+    NODE_LOGIC,       ///< a && b, a || b
+    NODE_TERNARY,     ///< a ? b : c
+    NODE_ASSIGN,      ///< a = b, a += b, a -= b
+};
+
+/// A node of the syntax tree. Nodes own all of their children.
+class Node
+{
+public:
+    Node(int type, int position);
+    ~Node();
+
+    int type; ///< One of NODE_TYPES
+    int op; ///< The operator token, for operator nodes
+    int position; ///< Position of the node in the source it was parsed from
+    Name name; ///< Identifier, property or class name, or string contents
+    long intValue; ///< Value of an integer literal
+    double doubleValue; ///< Value of a floating point literal
+    Node *a, *b, *c, *d; ///< Operands and sub-statements, see NODE_TYPES
+    std::vector<Node*> list; ///< Statements, arguments or literal contents
+    std::vector<Name> names; ///< Parameters, object keys or a dotted path
+    CompiledCode *code; ///< Body of a function
+};
+
+/** Some source together with its syntax tree (and bytecode). This is reference counted as function
+    variables keep hold of their body well after the script defining them has gone. */
+class CompiledCode
+{
+public:
+    CompiledCode(const std::string &text);
+    CompiledCode(const SourceSlice &source); ///< Code that is part of some bigger source (like a function body)
+    ~CompiledCode();
+
+    SourceSlice source; ///< The code the tree was parsed from
+    Node *root; ///< The syntax tree, 0 until it is parsed
+    Bytecode *bytecode; ///< The tree compiled for ENGINE_VM, 0 until it is needed
+
+    std::string getPosition(int pos) const; ///< Return a string representing the position in lines and columns of the character pos given
+
+    CompiledCode *ref(); ///< Add reference to this code
+    void unref(); ///< Remove a reference, and delete this code if required
+protected:
+    int refs; ///< The number of references held to this code
+};
+
+/** Builds a syntax tree out of a Lexer. This accepts exactly what the statement/base/factor
+    functions of the Interpreter accept, and with the same precedence. */
+class Parser
+{
+public:
+    Parser(const SourceSlice &source);
+    ~Parser();
+
+    Lexer *l; ///< The lexer tokens are read from
+
+    Node *parseProgram(); ///< Statements up to the end of the input
+    Node *parseExpressions(); ///< Semicolon separated expressions, as evaluateComplex expects
+    Node *parseBody(); ///< A function body
+
+protected:
+    Node *node(int type);
+    Node *node(int type, int op, Node *a, Node *b = 0);
+
+    Node *parseFunctionDefinition();
+    void parseArguments(Node *node);
+    Node *factor();
+    Node *unary();
+    Node *term();
+    Node *expression();
+    Node *shift();
+    Node *condition();
+    Node *logic();
+    Node *ternary();
+    Node *base();
+    Node *block();
+    Node *statement();
+};
+
+}; // namespace TinyJS
+
+#endif
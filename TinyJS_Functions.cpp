@@ -37,138 +37,143 @@
 namespace TinyJS {
 
 // ----------------------------------------------- Actual Functions
-void scTrace(Variable *c, void *userdata) {
+void scTrace(CallFrame *c, void *userdata) {
     Interpreter *js = reinterpret_cast<Interpreter*>(userdata);
     js->root->trace();
 }
 
-void scObjectDump(Variable *c, void *) {
-    c->getParameter("this")->trace("> ");
+void scObjectDump(CallFrame *c, void *) {
+    c->getThis()->trace("> ");
 }
 
-void scObjectClone(Variable *c, void *) {
-    Variable *obj = c->getParameter("this");
+void scObjectClone(CallFrame *c, void *) {
+    Variable *obj = c->getThis();
     c->getReturnVar()->copyValue(obj);
 }
 
-void scMathRand(Variable *c, void *) {
+void scMathRand(CallFrame *c, void *) {
     c->getReturnVar()->setDouble((double)rand()/RAND_MAX);
 }
 
-void scMathRandInt(Variable *c, void *) {
-    int min = c->getParameter("min")->getInt();
-    int max = c->getParameter("max")->getInt();
+void scMathRandInt(CallFrame *c, void *) {
+    int min = c->getArgument(0)->getInt();
+    int max = c->getArgument(1)->getInt();
     int val = min + (int)(rand()%(1+max-min));
     c->getReturnVar()->setInt(val);
 }
 
-void scCharToInt(Variable *c, void *) {
-    std::string str = c->getParameter("ch")->getString();;
+void scCharToInt(CallFrame *c, void *) {
+    char buffer[TINYJS_NUMBER_BUFFER];
+    StringView str = c->getArgument(0)->getStringView(buffer);
     int val = 0;
-    if (str.length()>0)
-        val = (int)str.c_str()[0];
+    if (str.length>0)
+        val = (int)str.data[0];
     c->getReturnVar()->setInt(val);
 }
 
-void scStringIndexOf(Variable *c, void *) {
-    std::string str = c->getParameter("this")->getString();
-    std::string search = c->getParameter("search")->getString();
-    size_t p = str.find(search);
-    int val = (p==std::string::npos) ? -1 : p;
-    c->getReturnVar()->setInt(val);
+void scStringIndexOf(CallFrame *c, void *) {
+    char buffer[TINYJS_NUMBER_BUFFER], searchBuffer[TINYJS_NUMBER_BUFFER];
+    StringView str = c->getThis()->getStringView(buffer);
+    StringView search = c->getArgument(0)->getStringView(searchBuffer);
+    c->getReturnVar()->setInt(str.find(search));
 }
 
-void scStringSubstring(Variable *c, void *) {
-    std::string str = c->getParameter("this")->getString();
-    int lo = c->getParameter("lo")->getInt();
-    int hi = c->getParameter("hi")->getInt();
+void scStringSubstring(CallFrame *c, void *) {
+    char buffer[TINYJS_NUMBER_BUFFER];
+    StringView str = c->getThis()->getStringView(buffer);
+    int lo = c->getArgument(0)->getInt();
+    int hi = c->getArgument(1)->getInt();
 
     int l = hi-lo;
-    if (l>0 && lo>=0 && lo+l<=(int)str.length())
-      c->getReturnVar()->setString(str.substr(lo, l));
+    if (l>0 && lo>=0 && lo+l<=str.length)
+      c->getReturnVar()->setString(str.substr(lo, l).str());
     else
       c->getReturnVar()->setString("");
 }
 
-void scStringCharAt(Variable *c, void *) {
-    std::string str = c->getParameter("this")->getString();
-    int p = c->getParameter("pos")->getInt();
-    if (p>=0 && p<(int)str.length())
-      c->getReturnVar()->setString(str.substr(p, 1));
+void scStringCharAt(CallFrame *c, void *) {
+    char buffer[TINYJS_NUMBER_BUFFER];
+    StringView str = c->getThis()->getStringView(buffer);
+    int p = c->getArgument(0)->getInt();
+    if (p>=0 && p<str.length)
+      c->getReturnVar()->setString(str.substr(p, 1).str());
     else
       c->getReturnVar()->setString("");
 }
 
-void scStringCharCodeAt(Variable *c, void *) {
-    std::string str = c->getParameter("this")->getString();
-    int p = c->getParameter("pos")->getInt();
-    if (p>=0 && p<(int)str.length())
-      c->getReturnVar()->setInt(str.at(p));
+void scStringCharCodeAt(CallFrame *c, void *) {
+    char buffer[TINYJS_NUMBER_BUFFER];
+    StringView str = c->getThis()->getStringView(buffer);
+    int p = c->getArgument(0)->getInt();
+    if (p>=0 && p<str.length)
+      c->getReturnVar()->setInt(str.data[p]);
     else
       c->getReturnVar()->setInt(0);
 }
 
-void scStringSplit(Variable *c, void *) {
-    std::string str = c->getParameter("this")->getString();
-    std::string sep = c->getParameter("separator")->getString();
+void scStringSplit(CallFrame *c, void *) {
+    char buffer[TINYJS_NUMBER_BUFFER], sepBuffer[TINYJS_NUMBER_BUFFER];
+    StringView str = c->getThis()->getStringView(buffer);
+    StringView sep = c->getArgument(0)->getStringView(sepBuffer);
     Variable *result = c->getReturnVar();
     result->setArray();
     int length = 0;
 
-    size_t pos = str.find(sep);
-    while (pos != std::string::npos) {
-      result->setArrayIndex(length++, new Variable(str.substr(0,pos)));
-      str = str.substr(pos+1);
+    int pos = str.find(sep);
+    while (pos >= 0) {
+      result->setArrayIndex(length++, new Variable(str.substr(0,pos).str()));
+      str = str.substr(pos+1, str.length-(pos+1));
       pos = str.find(sep);
     }
 
-    if (str.size()>0)
-      result->setArrayIndex(length++, new Variable(str));
+    if (str.length>0)
+      result->setArrayIndex(length++, new Variable(str.str()));
 }
 
-void scStringFromCharCode(Variable *c, void *) {
+void scStringFromCharCode(CallFrame *c, void *) {
     char str[2];
-    str[0] = c->getParameter("char")->getInt();
+    str[0] = c->getArgument(0)->getInt();
     str[1] = 0;
     c->getReturnVar()->setString(str);
 }
 
-void scIntegerParseInt(Variable *c, void *) {
-    std::string str = c->getParameter("str")->getString();
-    int val = strtol(str.c_str(),0,0);
+void scIntegerParseInt(CallFrame *c, void *) {
+    std::string str = c->getArgument(0)->getString();
+    int val = parseInteger(str.c_str());
     c->getReturnVar()->setInt(val);
 }
 
-void scIntegerValueOf(Variable *c, void *) {
-    std::string str = c->getParameter("str")->getString();
+void scIntegerValueOf(CallFrame *c, void *) {
+    char buffer[TINYJS_NUMBER_BUFFER];
+    StringView str = c->getArgument(0)->getStringView(buffer);
 
     int val = 0;
-    if (str.length()==1)
-      val = str[0];
+    if (str.length==1)
+      val = str.data[0];
     c->getReturnVar()->setInt(val);
 }
 
-void scJSONStringify(Variable *c, void *) {
+void scJSONStringify(CallFrame *c, void *) {
     std::ostringstream result;
-    c->getParameter("obj")->getJSON(result);
+    c->getArgument(0)->getJSON(result);
     c->getReturnVar()->setString(result.str());
 }
 
-void scExec(Variable *c, void *data) {
+void scExec(CallFrame *c, void *data) {
     Interpreter *interpreter = reinterpret_cast<Interpreter *>(data);
-    std::string str = c->getParameter("jsCode")->getString();
+    std::string str = c->getArgument(0)->getString();
     interpreter->execute(str);
 }
 
-void scEval(Variable *c, void *data) {
+void scEval(CallFrame *c, void *data) {
     Interpreter *interpreter = reinterpret_cast<Interpreter *>(data);
-    std::string str = c->getParameter("jsCode")->getString();
+    std::string str = c->getArgument(0)->getString();
     c->setReturnVar(interpreter->evaluateComplex(str).var);
 }
 
-void scArrayContains(Variable *c, void *data) {
-  Variable *obj = c->getParameter("obj");
-  VariableLink *v = c->getParameter("this")->firstChild;
+void scArrayContains(CallFrame *c, void *data) {
+  Variable *obj = c->getArgument(0);
+  VariableLink *v = c->getThis()->firstChild;
 
   bool contains = false;
   while (v) {
@@ -182,12 +187,12 @@ void scArrayContains(Variable *c, void *data) {
   c->getReturnVar()->setInt(contains);
 }
 
-void scArrayRemove(Variable *c, void *data) {
-  Variable *obj = c->getParameter("obj");
+void scArrayRemove(CallFrame *c, void *data) {
+  Variable *obj = c->getArgument(0);
   std::vector<int> removedIndices;
   VariableLink *v;
   // remove
-  v = c->getParameter("this")->firstChild;
+  v = c->getThis()->firstChild;
   while (v) {
       if (v->var->equals(obj)) {
         removedIndices.push_back(v->getIntName());
@@ -195,31 +200,38 @@ void scArrayRemove(Variable *c, void *data) {
       v = v->nextSibling;
   }
   // renumber
-  v = c->getParameter("this")->firstChild;
+  Variable *arr = c->getThis();
+  v = arr->firstChild;
   while (v) {
       int n = v->getIntName();
       int newn = n;
       for (size_t i=0;i<removedIndices.size();i++)
         if (n>=removedIndices[i])
           newn--;
-      if (newn!=n)
-        v->setIntName(newn);
+      if (newn!=n) {
+        char sIdx[TINYJS_NUMBER_BUFFER];
+        formatInteger(sIdx, newn);
+        arr->renameChild(v, sIdx);
+      }
       v = v->nextSibling;
   }
 }
 
-void scArrayJoin(Variable *c, void *data) {
-  std::string sep = c->getParameter("separator")->getString();
-  Variable *arr = c->getParameter("this");
+void scArrayJoin(CallFrame *c, void *data) {
+  char buffer[TINYJS_NUMBER_BUFFER];
+  StringView sep = c->getArgument(0)->getStringView(buffer);
+  Variable *arr = c->getThis();
 
-  std::ostringstream sstr;
+  std::string str;
   int l = arr->getArrayLength();
   for (int i=0;i<l;i++) {
-    if (i>0) sstr << sep;
-    sstr << arr->getArrayIndex(i)->getString();
+    if (i>0) str.append(sep.data, sep.length);
+    char elementBuffer[TINYJS_NUMBER_BUFFER];
+    StringView element = arr->getArrayIndex(i)->getStringView(elementBuffer);
+    str.append(element.data, element.length);
   }
 
-  c->getReturnVar()->setString(sstr.str());
+  c->getReturnVar()->setString(str);
 }
 
 // ----------------------------------------------- Register Functions
@@ -46,11 +46,11 @@ namespace TinyJS {
 #define F_RNG(a,min,max)    ((a)<(min) ? min : ((a)>(max) ? max : a ))
 #define F_ROUND(a)          ((a)>0 ? (int) ((a)+0.5) : (int) ((a)-0.5) )
  
-//Variable shortcut macro
-#define scIsInt(a)          ( c->getParameter(a)->isInt() )
-#define scIsDouble(a)       ( c->getParameter(a)->isDouble() )  
-#define scGetInt(a)         ( c->getParameter(a)->getInt() )
-#define scGetDouble(a)      ( c->getParameter(a)->getDouble() )  
+//Variable shortcut macro (arguments are given by position)
+#define scIsInt(n)          ( c->getArgument(n)->isInt() )
+#define scIsDouble(n)       ( c->getArgument(n)->isDouble() )  
+#define scGetInt(n)         ( c->getArgument(n)->getInt() )
+#define scGetDouble(n)      ( c->getArgument(n)->getDouble() )  
 #define scReturnInt(a)      ( c->getReturnVar()->setInt(a) )
 #define scReturnDouble(a)   ( c->getReturnVar()->setDouble(a) )  
 
@@ -84,167 +84,167 @@ namespace
 #endif
 
 //Math.abs(x) - returns absolute of given value
-void scMathAbs(Variable *c, void *userdata) {
-    if ( scIsInt("a") ) {
-      scReturnInt( F_ABS( scGetInt("a") ) );
-    } else if ( scIsDouble("a") ) {
-      scReturnDouble( F_ABS( scGetDouble("a") ) );
+void scMathAbs(CallFrame *c, void *userdata) {
+    if ( scIsInt(0) ) {
+      scReturnInt( F_ABS( scGetInt(0) ) );
+    } else if ( scIsDouble(0) ) {
+      scReturnDouble( F_ABS( scGetDouble(0) ) );
     }
 }
 
 //Math.round(a) - returns nearest round of given value
-void scMathRound(Variable *c, void *userdata) {
-    if ( scIsInt("a") ) {
-      scReturnInt( F_ROUND( scGetInt("a") ) );
-    } else if ( scIsDouble("a") ) {
-      scReturnDouble( F_ROUND( scGetDouble("a") ) );
+void scMathRound(CallFrame *c, void *userdata) {
+    if ( scIsInt(0) ) {
+      scReturnInt( F_ROUND( scGetInt(0) ) );
+    } else if ( scIsDouble(0) ) {
+      scReturnDouble( F_ROUND( scGetDouble(0) ) );
     }
 }
 
 //Math.min(a,b) - returns minimum of two given values 
-void scMathMin(Variable *c, void *userdata) {
-    if ( (scIsInt("a")) && (scIsInt("b")) ) {
-      scReturnInt( F_MIN( scGetInt("a"), scGetInt("b") ) );
+void scMathMin(CallFrame *c, void *userdata) {
+    if ( (scIsInt(0)) && (scIsInt(1)) ) {
+      scReturnInt( F_MIN( scGetInt(0), scGetInt(1) ) );
     } else {
-      scReturnDouble( F_MIN( scGetDouble("a"), scGetDouble("b") ) );
+      scReturnDouble( F_MIN( scGetDouble(0), scGetDouble(1) ) );
     }
 }
 
 //Math.max(a,b) - returns maximum of two given values  
-void scMathMax(Variable *c, void *userdata) {
-    if ( (scIsInt("a")) && (scIsInt("b")) ) {
-      scReturnInt( F_MAX( scGetInt("a"), scGetInt("b") ) );
+void scMathMax(CallFrame *c, void *userdata) {
+    if ( (scIsInt(0)) && (scIsInt(1)) ) {
+      scReturnInt( F_MAX( scGetInt(0), scGetInt(1) ) );
     } else {
-      scReturnDouble( F_MAX( scGetDouble("a"), scGetDouble("b") ) );
+      scReturnDouble( F_MAX( scGetDouble(0), scGetDouble(1) ) );
     }
 }
 
 //Math.range(x,a,b) - returns value limited between two given values  
-void scMathRange(Variable *c, void *userdata) {
-    if ( (scIsInt("x")) ) {
-      scReturnInt( F_RNG( scGetInt("x"), scGetInt("a"), scGetInt("b") ) );
+void scMathRange(CallFrame *c, void *userdata) {
+    if ( (scIsInt(0)) ) {
+      scReturnInt( F_RNG( scGetInt(0), scGetInt(1), scGetInt(2) ) );
     } else {
-      scReturnDouble( F_RNG( scGetDouble("x"), scGetDouble("a"), scGetDouble("b") ) );
+      scReturnDouble( F_RNG( scGetDouble(0), scGetDouble(1), scGetDouble(2) ) );
     }
 }
 
 //Math.sign(a) - returns sign of given value (-1==negative,0=zero,1=positive)
-void scMathSign(Variable *c, void *userdata) {
-    if ( scIsInt("a") ) {
-      scReturnInt( F_SGN( scGetInt("a") ) );
-    } else if ( scIsDouble("a") ) {
-      scReturnDouble( F_SGN( scGetDouble("a") ) );
+void scMathSign(CallFrame *c, void *userdata) {
+    if ( scIsInt(0) ) {
+      scReturnInt( F_SGN( scGetInt(0) ) );
+    } else if ( scIsDouble(0) ) {
+      scReturnDouble( F_SGN( scGetDouble(0) ) );
     }
 }
 
 //Math.PI() - returns PI value
-void scMathPI(Variable *c, void *userdata) {
+void scMathPI(CallFrame *c, void *userdata) {
     scReturnDouble(k_PI);
 }
 
 //Math.toDegrees(a) - returns degree value of a given angle in radians
-void scMathToDegrees(Variable *c, void *userdata) {
-    scReturnDouble( (180.0/k_PI)*( scGetDouble("a") ) );
+void scMathToDegrees(CallFrame *c, void *userdata) {
+    scReturnDouble( (180.0/k_PI)*( scGetDouble(0) ) );
 }
 
 //Math.toRadians(a) - returns radians value of a given angle in degrees
-void scMathToRadians(Variable *c, void *userdata) {
-    scReturnDouble( (k_PI/180.0)*( scGetDouble("a") ) );
+void scMathToRadians(CallFrame *c, void *userdata) {
+    scReturnDouble( (k_PI/180.0)*( scGetDouble(0) ) );
 }
 
 //Math.sin(a) - returns trig. sine of given angle in radians
-void scMathSin(Variable *c, void *userdata) {
-    scReturnDouble( sin( scGetDouble("a") ) );
+void scMathSin(CallFrame *c, void *userdata) {
+    scReturnDouble( sin( scGetDouble(0) ) );
 }
 
 //Math.asin(a) - returns trig. arcsine of given angle in radians
-void scMathASin(Variable *c, void *userdata) {
-    scReturnDouble( asin( scGetDouble("a") ) );
+void scMathASin(CallFrame *c, void *userdata) {
+    scReturnDouble( asin( scGetDouble(0) ) );
 }
 
 //Math.cos(a) - returns trig. cosine of given angle in radians
-void scMathCos(Variable *c, void *userdata) {
-    scReturnDouble( cos( scGetDouble("a") ) );
+void scMathCos(CallFrame *c, void *userdata) {
+    scReturnDouble( cos( scGetDouble(0) ) );
 }
 
 //Math.acos(a) - returns trig. arccosine of given angle in radians
-void scMathACos(Variable *c, void *userdata) {
-    scReturnDouble( acos( scGetDouble("a") ) );
+void scMathACos(CallFrame *c, void *userdata) {
+    scReturnDouble( acos( scGetDouble(0) ) );
 }
 
 //Math.tan(a) - returns trig. tangent of given angle in radians
-void scMathTan(Variable *c, void *userdata) {
-    scReturnDouble( tan( scGetDouble("a") ) );
+void scMathTan(CallFrame *c, void *userdata) {
+    scReturnDouble( tan( scGetDouble(0) ) );
 }
 
 //Math.atan(a) - returns trig. arctangent of given angle in radians
-void scMathATan(Variable *c, void *userdata) {
-    scReturnDouble( atan( scGetDouble("a") ) );
+void scMathATan(CallFrame *c, void *userdata) {
+    scReturnDouble( atan( scGetDouble(0) ) );
 }
 
 //Math.sinh(a) - returns trig. hyperbolic sine of given angle in radians
-void scMathSinh(Variable *c, void *userdata) {
-    scReturnDouble( sinh( scGetDouble("a") ) );
+void scMathSinh(CallFrame *c, void *userdata) {
+    scReturnDouble( sinh( scGetDouble(0) ) );
 }
 
 //Math.asinh(a) - returns trig. hyperbolic arcsine of given angle in radians
-void scMathASinh(Variable *c, void *userdata) {
-    scReturnDouble( asinh( scGetDouble("a") ) );
+void scMathASinh(CallFrame *c, void *userdata) {
+    scReturnDouble( asinh( scGetDouble(0) ) );
 }
 
 //Math.cosh(a) - returns trig. hyperbolic cosine of given angle in radians
-void scMathCosh(Variable *c, void *userdata) {
-    scReturnDouble( cosh( scGetDouble("a") ) );
+void scMathCosh(CallFrame *c, void *userdata) {
+    scReturnDouble( cosh( scGetDouble(0) ) );
 }
 
 //Math.acosh(a) - returns trig. hyperbolic arccosine of given angle in radians
-void scMathACosh(Variable *c, void *userdata) {
-    scReturnDouble( acosh( scGetDouble("a") ) );
+void scMathACosh(CallFrame *c, void *userdata) {
+    scReturnDouble( acosh( scGetDouble(0) ) );
 }
 
 //Math.tanh(a) - returns trig. hyperbolic tangent of given angle in radians
-void scMathTanh(Variable *c, void *userdata) {
-    scReturnDouble( tanh( scGetDouble("a") ) );
+void scMathTanh(CallFrame *c, void *userdata) {
+    scReturnDouble( tanh( scGetDouble(0) ) );
 }
 
 //Math.atan(a) - returns trig. hyperbolic arctangent of given angle in radians
-void scMathATanh(Variable *c, void *userdata) {
-    scReturnDouble( atan( scGetDouble("a") ) );
+void scMathATanh(CallFrame *c, void *userdata) {
+    scReturnDouble( atan( scGetDouble(0) ) );
 }
 
 //Math.E() - returns E Neplero value
-void scMathE(Variable *c, void *userdata) {
+void scMathE(CallFrame *c, void *userdata) {
     scReturnDouble(k_E);
 }
 
 //Math.log(a) - returns natural logaritm (base E) of given value
-void scMathLog(Variable *c, void *userdata) {
-    scReturnDouble( log( scGetDouble("a") ) );
+void scMathLog(CallFrame *c, void *userdata) {
+    scReturnDouble( log( scGetDouble(0) ) );
 }
 
 //Math.log10(a) - returns logaritm(base 10) of given value
-void scMathLog10(Variable *c, void *userdata) {
-    scReturnDouble( log10( scGetDouble("a") ) );
+void scMathLog10(CallFrame *c, void *userdata) {
+    scReturnDouble( log10( scGetDouble(0) ) );
 }
 
 //Math.exp(a) - returns e raised to the power of a given number
-void scMathExp(Variable *c, void *userdata) {
-    scReturnDouble( exp( scGetDouble("a") ) );
+void scMathExp(CallFrame *c, void *userdata) {
+    scReturnDouble( exp( scGetDouble(0) ) );
 }
 
 //Math.pow(a,b) - returns the result of a number raised to a power (a)^(b)
-void scMathPow(Variable *c, void *userdata) {
-    scReturnDouble( pow( scGetDouble("a"), scGetDouble("b") ) );
+void scMathPow(CallFrame *c, void *userdata) {
+    scReturnDouble( pow( scGetDouble(0), scGetDouble(1) ) );
 }
 
 //Math.sqr(a) - returns square of given value
-void scMathSqr(Variable *c, void *userdata) {
-    scReturnDouble( ( scGetDouble("a") * scGetDouble("a") ) );
+void scMathSqr(CallFrame *c, void *userdata) {
+    scReturnDouble( ( scGetDouble(0) * scGetDouble(0) ) );
 }
 
 //Math.sqrt(a) - returns square root of given value
-void scMathSqrt(Variable *c, void *userdata) {
-    scReturnDouble( sqrt( scGetDouble("a") ) );
+void scMathSqrt(CallFrame *c, void *userdata) {
+    scReturnDouble( sqrt( scGetDouble(0) ) );
 }
 
 // ----------------------------------------------- Register Functions
@@ -0,0 +1,1042 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Bytecode compiler and register based virtual machine
+ *
+ * Authored By Gordon Williams <gw@pur3.co.uk>
+ * Additional Coding By Marco Lizza <marco.lizza@gmail.com>
+ *
+ * Copyright (C) 2009 Pur3 Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* The syntax tree is flattened into instructions working on a small array of
+ * registers, one array per call. Each expression node is given the register
+ * its result should end up in, and the registers its operands need are taken
+ * from the top of the array and given back straight after, so a call only
+ * needs as many registers as the deepest expression in it.
+ *
+ * A register is a Value: either a VariableLink, or a number, null or undefined
+ * held in the register itself (NaN boxed), so maths on them doesn't allocate.
+ * getRegisterLink only turns one of those into a Variable, in a temporary, when
+ * it is stored or needed as a link. Temporaries are freed by OP_RELEASE at the
+ * end of each statement, exactly as runStatement does. Loops keep the same
+ * iteration counters as the other engines too.
+ */
+
+#include "TinyJS_VM.h"
+#include <assert.h>
+#include <string.h>
+#include <sstream>
+#include <cstdlib>
+#include <stdio.h>
+
+#ifndef ASSERT
+  #define ASSERT(X) assert(X)
+#endif
+
+#ifdef __GNUC__
+  #define sprintf_s snprintf
+#endif
+
+#ifdef _WIN32_WCE
+  #include <strsafe.h>
+  #define sprintf_s StringCbPrintfA
+#endif
+
+/// Registers and loop counters kept on the C stack - more than this and they go on the heap
+#define TINYJS_VM_LOCAL_REGISTERS 32
+
+namespace TinyJS {
+
+// ----------------------------------------------------------------------------------- BYTECODE
+
+Bytecode::Bytecode() {
+    registers = 0;
+    loops = 0;
+    locals = 0;
+    parameters = 0;
+}
+
+Bytecode::~Bytecode() {
+    for (size_t i=0;i<caches.size();i++)
+      for (int n=0;n<caches[i].count;n++)
+        caches[i].shapes[n]->unref();
+}
+
+const char *Bytecode::getOpcodeName(int op) {
+    static const char *names[] = {
+#define TINYJS_OPCODE_NAME(NAME) #NAME,
+      TINYJS_OPCODES(TINYJS_OPCODE_NAME)
+#undef TINYJS_OPCODE_NAME
+    };
+    if (op<0 || op>=OP_COUNT) return "?";
+    return names[op];
+}
+
+void Bytecode::dump() const {
+    TRACE("%d registers, %d loops, %d locals\n", registers, loops, locals);
+    for (size_t i=0;i<code.size();i++)
+      TRACE("%4d %-16s %d %d %d\n", (int)i, getOpcodeName(code[i].op), code[i].a, code[i].b, code[i].c);
+}
+
+// ----------------------------------------------------------------------------------- COMPILER
+
+Compiler::Compiler(Bytecode *bytecode) {
+    bc = bytecode;
+    nextRegister = 0;
+    position = 0;
+}
+
+void Compiler::compileProgram(Node *root) {
+    statement(root);
+    emit(OP_END);
+}
+
+void Compiler::compileExpressions(Node *root) {
+    // only the value of the last expression is kept
+    int r = allocate();
+    emit(OP_LOAD_UNDEFINED, r);
+    for (size_t i=0;i<root->list.size();i++) {
+      emit(OP_RELEASE);
+      expression(root->list[i], r);
+    }
+    emit(OP_RESULT, r);
+    release(r);
+}
+
+void Compiler::compileBody(Node *root, const std::vector<std::string> &parameters) {
+    addLocal("this");
+    // parameters always get the slot matching their position, even if they repeat
+    for (size_t i=0;i<parameters.size();i++)
+      if (locals.find(parameters[i]) == locals.end())
+        locals[parameters[i]] = 1+(int)i;
+    bc->parameters = (int)parameters.size();
+    bc->locals = 1+bc->parameters;
+    findLocals(root);
+    statement(root);
+    emit(OP_END);
+}
+
+int Compiler::emit(int op, int a, int b, int c) {
+    Instruction i;
+    i.op = op;
+    i.a = a;
+    i.b = b;
+    i.c = c;
+    bc->code.push_back(i);
+    bc->positions.push_back(position);
+    return (int)bc->code.size()-1;
+}
+
+int Compiler::here() const {
+    return (int)bc->code.size();
+}
+
+void Compiler::patch(int instruction, int target) {
+    bc->code[instruction].c = target;
+}
+
+int Compiler::allocate() {
+    int r = nextRegister++;
+    if (nextRegister > bc->registers) bc->registers = nextRegister;
+    return r;
+}
+
+void Compiler::release(int reg) {
+    // registers are always given back in the opposite order to how they were taken
+    ASSERT(reg == nextRegister-1);
+    nextRegister = reg;
+}
+
+int Compiler::string(const std::string &str) {
+    std::map<std::string, int>::iterator it = stringIndex.find(str);
+    if (it != stringIndex.end()) return it->second;
+    int k = (int)bc->strings.size();
+    bc->strings.push_back(str);
+    stringIndex[str] = k;
+    return k;
+}
+
+int Compiler::cache(const std::string &name) {
+    InlineCache cache;
+    cache.name = string(name);
+    cache.count = 0;
+    bc->caches.push_back(cache);
+    return (int)bc->caches.size()-1;
+}
+
+int Compiler::local(const std::string &name) {
+    std::map<std::string, int>::iterator it = locals.find(name);
+    return it == locals.end() ? -1 : it->second;
+}
+
+void Compiler::addLocal(const std::string &name) {
+    if (locals.find(name) == locals.end())
+      locals[name] = bc->locals++;
+}
+
+void Compiler::findLocals(Node *node) {
+    if (!node) return;
+    switch (node->type) {
+      case NODE_BLOCK:
+        for (size_t i=0;i<node->list.size();i++)
+          findLocals(node->list[i]);
+        break;
+      case NODE_VAR:
+        for (size_t i=0;i<node->list.size();i++)
+          addLocal(node->list[i]->names[0]);
+        break;
+      case NODE_IF:
+        findLocals(node->b);
+        findLocals(node->c);
+        break;
+      case NODE_WHILE:
+        findLocals(node->b);
+        break;
+      case NODE_FOR:
+        findLocals(node->a);
+        findLocals(node->d);
+        break;
+      case NODE_DEFINE:
+        if (node->a->name != TINYJS_TEMP_NAME)
+          addLocal(node->a->name);
+        break;
+    }
+}
+
+void Compiler::arguments(Node *node, int base) {
+    for (size_t i=0;i<node->list.size();i++) {
+      int r = base+2+(int)i;
+      expression(node->list[i], r);
+      emit(OP_ARGUMENT, r);
+    }
+}
+
+void Compiler::statement(Node *node) {
+    int oldPosition = position;
+    position = node->position;
+    switch (node->type) {
+      case NODE_EMPTY:
+        break;
+      case NODE_BLOCK:
+        for (size_t i=0;i<node->list.size();i++)
+          statement(node->list[i]);
+        break;
+      case NODE_EXPRESSION: {
+        int r = allocate();
+        discarded(node->a, r);
+        release(r);
+        emit(OP_RELEASE);
+      } break;
+      case NODE_VAR:
+        for (size_t i=0;i<node->list.size();i++) {
+          Node *declaration = node->list[i];
+          int r = allocate();
+          int slot = local(declaration->names[0]);
+          if (slot >= 0)
+            emit(OP_DECLARE_LOCAL, r, string(declaration->names[0]), slot);
+          else
+            emit(OP_DECLARE, r, string(declaration->names[0]));
+          // now do stuff defined with dots
+          for (size_t n=1;n<declaration->names.size();n++)
+            emit(OP_DECLARE_MEMBER, r, string(declaration->names[n]));
+          // sort out initialiser
+          if (declaration->a) {
+            int t = allocate();
+            expression(declaration->a, t);
+            emit(OP_ASSIGN, r, t);
+            release(t);
+          }
+          release(r);
+          emit(OP_RELEASE);
+        }
+        break;
+      case NODE_IF: {
+        int r = allocate();
+        expression(node->a, r);
+        release(r);
+        int branch = emit(OP_BRANCH_FALSE, r);
+        statement(node->b);
+        if (node->c) {
+          int jump = emit(OP_JUMP);
+          patch(branch, here());
+          statement(node->c);
+          patch(jump, here());
+        } else
+          patch(branch, here());
+      } break;
+      case NODE_WHILE:
+      case NODE_FOR: {
+        Node *condition = node->type==NODE_WHILE ? node->a : node->b;
+        Node *body = node->type==NODE_WHILE ? node->b : node->d;
+        if (node->type==NODE_FOR)
+          statement(node->a); // initialisation
+        int counter = bc->loops++;
+        emit(OP_LOOP_START, counter);
+        int loop = here();
+        int r = allocate();
+        expression(condition, r);
+        release(r);
+        int branch = emit(OP_BRANCH_FALSE, r);
+        statement(body);
+        if (node->type==NODE_FOR) {
+          r = allocate();
+          discarded(node->c, r); // iterator
+          release(r);
+          emit(OP_RELEASE);
+        }
+        emit(OP_LOOP_NEXT, counter, 0, loop);
+        patch(branch, here());
+        emit(OP_LOOP_END, counter, 0, node->type==NODE_WHILE ? 'w' : 'f');
+      } break;
+      case NODE_RETURN:
+        if (node->a) {
+          int r = allocate();
+          expression(node->a, r);
+          release(r);
+          emit(OP_RETURN, r);
+        } else
+          emit(OP_RETURN, -1);
+        break;
+      case NODE_DEFINE:
+        bc->functions.push_back(node->a);
+        emit(OP_DEFINE, (int)bc->functions.size()-1, local(node->a->name));
+        break;
+      default:
+        ASSERT(0);
+    }
+    position = oldPosition;
+}
+
+void Compiler::discarded(Node *node, int dst) {
+    if (node->type != NODE_POSTFIX) {
+      expression(node, dst);
+      return;
+    }
+    // nobody needs the old value, so it can be added to/subtracted from in place
+    expression(node->a, dst);
+    int oldPosition = position;
+    position = node->position;
+    emit(node->op==LEXER_PLUSPLUS ? OP_INCREMENT : OP_DECREMENT, dst);
+    position = oldPosition;
+}
+
+void Compiler::expression(Node *node, int dst) {
+    int oldPosition = position;
+    position = node->position;
+    switch (node->type) {
+      case NODE_INT:
+        bc->ints.push_back(node->intValue);
+        emit(OP_LOAD_INT, dst, (int)bc->ints.size()-1);
+        break;
+      case NODE_DOUBLE:
+        bc->doubles.push_back(node->doubleValue);
+        emit(OP_LOAD_DOUBLE, dst, (int)bc->doubles.size()-1);
+        break;
+      case NODE_STRING:
+        emit(OP_LOAD_STRING, dst, string(node->name));
+        break;
+      case NODE_TRUE:
+        emit(OP_LOAD_TRUE, dst);
+        break;
+      case NODE_FALSE:
+        emit(OP_LOAD_FALSE, dst);
+        break;
+      case NODE_NULL:
+        emit(OP_LOAD_NULL, dst);
+        break;
+      case NODE_UNDEFINED:
+        emit(OP_LOAD_UNDEFINED, dst);
+        break;
+      case NODE_ID: {
+        int slot = local(node->name);
+        if (slot >= 0)
+          emit(OP_LOAD_LOCAL, dst, slot, string(node->name));
+        else
+          emit(OP_LOAD_NAME, dst, string(node->name));
+      } break;
+      case NODE_MEMBER:
+        expression(node->a, dst);
+        emit(OP_GET_MEMBER, dst, dst, cache(node->name));
+        break;
+      case NODE_INDEX: {
+        expression(node->a, dst);
+        int t = allocate();
+        expression(node->b, t);
+        emit(OP_GET_INDEX, dst, dst, t);
+        release(t);
+      } break;
+      case NODE_CALL: {
+        // function, parent and the arguments all go in a row
+        int base = allocate();
+        allocate();
+        for (size_t i=0;i<node->list.size();i++)
+          allocate();
+        Node *callee = node->a;
+        if (callee->type == NODE_MEMBER) {
+          expression(callee->a, base+1);
+          emit(OP_GET_MEMBER, base, base+1, cache(callee->name));
+        } else if (callee->type == NODE_INDEX) {
+          expression(callee->a, base+1);
+          int t = allocate();
+          expression(callee->b, t);
+          emit(OP_GET_INDEX, base, base+1, t);
+          release(t);
+        } else {
+          expression(callee, base);
+          emit(OP_LOAD_NIL, base+1);
+        }
+        emit(OP_CHECK_FUNCTION, base);
+        arguments(node, base);
+        emit(OP_CALL, dst, base, (int)node->list.size());
+        for (int r=base+1+(int)node->list.size();r>=base;r--)
+          release(r);
+      } break;
+      case NODE_NEW: {
+        int base = allocate();
+        allocate();
+        for (size_t i=0;i<node->list.size();i++)
+          allocate();
+        int skip = emit(OP_NEW, base, string(node->name));
+        arguments(node, base);
+        emit(OP_CALL, base, base, (int)node->list.size());
+        patch(skip, here());
+        emit(OP_MOVE, dst, base+1);
+        for (int r=base+1+(int)node->list.size();r>=base;r--)
+          release(r);
+      } break;
+      case NODE_OBJECT: {
+        emit(OP_OBJECT, dst);
+        int t = allocate();
+        for (size_t i=0;i<node->list.size();i++) {
+          expression(node->list[i], t);
+          emit(OP_ADD_PROPERTY, dst, string(node->names[i]), t);
+        }
+        release(t);
+      } break;
+      case NODE_ARRAY: {
+        emit(OP_ARRAY, dst);
+        int t = allocate();
+        for (size_t i=0;i<node->list.size();i++) {
+          expression(node->list[i], t);
+          emit(OP_ADD_ELEMENT, dst, t, (int)i);
+        }
+        release(t);
+      } break;
+      case NODE_FUNCTION:
+        bc->functions.push_back(node);
+        emit(OP_FUNCTION, dst, (int)bc->functions.size()-1);
+        break;
+      case NODE_NOT:
+        expression(node->a, dst);
+        emit(OP_NOT, dst, dst);
+        break;
+      case NODE_NEGATE:
+        expression(node->a, dst);
+        emit(OP_NEGATE, dst, dst);
+        break;
+      case NODE_BINARY:
+      case NODE_SHIFT: {
+        int op;
+        switch (node->op) {
+          case '+': op = OP_ADD; break;
+          case '-': op = OP_SUB; break;
+          case '*': op = OP_MUL; break;
+          case '/': op = OP_DIV; break;
+          case '%': op = OP_MOD; break;
+          case '&': op = OP_BITAND; break;
+          case '|': op = OP_BITOR; break;
+          case '^': op = OP_BITXOR; break;
+          case LEXER_EQUAL: op = OP_EQUAL; break;
+          case LEXER_NEQUAL: op = OP_NEQUAL; break;
+          case LEXER_TYPEEQUAL: op = OP_TYPEEQUAL; break;
+          case LEXER_NTYPEEQUAL: op = OP_NTYPEEQUAL; break;
+          case '<': op = OP_LESS; break;
+          case LEXER_LEQUAL: op = OP_LEQUAL; break;
+          case '>': op = OP_GREATER; break;
+          case LEXER_GEQUAL: op = OP_GEQUAL; break;
+          case LEXER_LSHIFT: op = OP_LSHIFT; break;
+          case LEXER_RSHIFT: op = OP_RSHIFT; break;
+          case LEXER_RSHIFTUNSIGNED: op = OP_URSHIFT; break;
+          default: ASSERT(0); op = OP_END;
+        }
+        expression(node->a, dst);
+        int t = allocate();
+        expression(node->b, t);
+        emit(op, dst, dst, t);
+        release(t);
+      } break;
+      case NODE_POSTFIX:
+        expression(node->a, dst);
+        emit(node->op==LEXER_PLUSPLUS ? OP_POSTINC : OP_POSTDEC, dst, dst);
+        break;
+      case NODE_LOGIC: {
+        // if we know the outcome we don't bother to evaluate the other side
+        expression(node->a, dst);
+        int test = emit(node->op==LEXER_ANDAND ? OP_AND_TEST : OP_OR_TEST, dst);
+        int t = allocate();
+        expression(node->b, t);
+        emit(node->op==LEXER_ANDAND ? OP_AND_BOOL : OP_OR_BOOL, dst, t);
+        release(t);
+        patch(test, here());
+      } break;
+      case NODE_TERNARY: {
+        expression(node->a, dst);
+        int branch = emit(OP_JUMP_IF_FALSE, dst);
+        expression(node->b, dst);
+        int jump = emit(OP_JUMP);
+        patch(branch, here());
+        expression(node->c, dst);
+        patch(jump, here());
+      } break;
+      case NODE_ASSIGN: {
+        expression(node->a, dst);
+        emit(OP_ASSIGN_GLOBAL, dst);
+        int t = allocate();
+        expression(node->b, t);
+        if (node->op=='=') emit(OP_ASSIGN, dst, t);
+        else if (node->op==LEXER_PLUSEQUAL) emit(OP_ASSIGN_ADD, dst, t);
+        else if (node->op==LEXER_MINUSEQUAL) emit(OP_ASSIGN_SUB, dst, t);
+        else ASSERT(0);
+        release(t);
+      } break;
+      default:
+        ASSERT(0);
+    }
+    position = oldPosition;
+}
+
+// ----------------------------------------------------------------------------------- INTERPRETER
+
+#ifdef TINYJS_COMPUTED_GOTO
+  #define VM_CASE(NAME) L_##NAME:
+  #define VM_NEXT() { ins = &bc->code[++pc]; goto *labels[ins->op]; }
+  #define VM_JUMP(T) { pc = (T); ins = &bc->code[pc]; goto *labels[ins->op]; }
+#else
+  #define VM_CASE(NAME) case OP_##NAME:
+  #define VM_NEXT() { pc++; continue; }
+  #define VM_JUMP(T) { pc = (T); continue; }
+#endif
+
+/// The link in register R (see Interpreter::getRegisterLink)
+#define VM_LINK(R) (regs[R].isLink() ? regs[R].getLink() : getRegisterLink(regs[R]))
+
+// Numbers are worked out in the registers, and anything else is left to mathsOp
+#define VM_MATHS(NAME, OP) VM_CASE(NAME) { \
+      NumericValue va, vb; \
+      if (regs[ins->b].getNumeric(va) && regs[ins->c].getNumeric(vb)) { \
+        NumericValue::maths(va, vb, OP, va); \
+        regs[ins->a] = Value::fromNumeric(va); \
+      } else \
+        regs[ins->a] = temporary(VM_LINK(ins->b)->var->mathsOp(VM_LINK(ins->c)->var, OP)); \
+    } VM_NEXT()
+
+// ----------------------------------------------------------------------------------- VALUE
+
+bool Value::getNumeric(NumericValue &val) const {
+    if (isInt()) {
+      val.isDouble = false;
+      val.intData = getInt();
+    } else if (isDouble()) {
+      val.isDouble = true;
+      val.doubleData = getDouble();
+    } else if (isNull()) {
+      val.isDouble = false;
+      val.intData = 0;
+    } else if (isLink()) {
+      return getLink()->var->getNumeric(val);
+    } else
+      return false;
+    return true;
+}
+
+bool Value::getBool() const {
+    if (isInt()) return getInt() != 0;
+    if (isDouble()) return (int)getDouble() != 0;
+    if (isLink()) return getLink()->var->getBool();
+    return false;
+}
+
+int Value::toInt() const {
+    if (isInt()) return getInt();
+    if (isDouble()) return (int)getDouble();
+    if (isLink()) return getLink()->var->getInt();
+    return 0;
+}
+
+int Value::getType() const {
+    if (isInt()) return VARIABLE_INTEGER;
+    if (isDouble()) return VARIABLE_DOUBLE;
+    if (isNull()) return VARIABLE_NULL;
+    return VARIABLE_UNDEFINED;
+}
+
+Variable *Value::createVariable() const {
+    if (isInt()) return new Variable(getInt());
+    if (isDouble()) return new Variable(getDouble());
+    if (isNull()) return new Variable(TINYJS_BLANK_DATA, VARIABLE_NULL);
+    return new Variable();
+}
+
+/// The type of a number in (or linked from) a register, or -1 if it doesn't hold one
+static int getNumericType(const Value &value) {
+    if (!value.isLink()) return value.isUndefined() ? -1 : value.getType();
+    Variable *var = value.getLink()->var;
+    if (var->isInt()) return VARIABLE_INTEGER;
+    if (var->isDouble()) return VARIABLE_DOUBLE;
+    if (var->isNull()) return VARIABLE_NULL;
+    return -1;
+}
+
+VariableLink *Interpreter::getRegisterLink(Value &reg) {
+    if (reg.isLink()) return reg.getLink();
+    // only temporaries are made here, so they can be the shared constants
+    Variable *var;
+    if (reg.isInt()) var = Variable::getIntValue(reg.getInt());
+    else if (reg.isNull()) var = Variable::getNullValue();
+    else if (reg.isUndefined()) var = Variable::getUndefinedValue();
+    else var = reg.createVariable();
+    VariableLink *link = temporary(var);
+    reg = link;
+    return link;
+}
+
+/** Run some bytecode in the current scope. This returns the result of OP_RESULT (which
+ * is left in the temporaries for the caller to take), or 0. If errorPosition is given,
+ * the position of the instruction that failed is put in it when an exception is thrown.
+ * For a function body, thisLink and the parameters (which follow each other in the
+ * function's scope) fill in the first slots.
+ */
+VariableLink *Interpreter::runBytecode(Bytecode *bc, int *errorPosition, VariableLink *thisLink, VariableLink *parameters, int parameterCount) {
+#ifdef TINYJS_COMPUTED_GOTO
+    static void *labels[] = {
+#define TINYJS_OPCODE_LABEL(NAME) &&L_##NAME,
+      TINYJS_OPCODES(TINYJS_OPCODE_LABEL)
+#undef TINYJS_OPCODE_LABEL
+    };
+#endif
+    Value localRegisters[TINYJS_VM_LOCAL_REGISTERS];
+    VariableLink *localSlots[TINYJS_VM_LOCAL_REGISTERS];
+    int localCounters[TINYJS_VM_LOCAL_REGISTERS];
+    std::vector<Value> heapRegisters;
+    std::vector<VariableLink*> heapSlots;
+    std::vector<int> heapCounters;
+    Value *regs = localRegisters;
+    VariableLink **slots = localSlots;
+    int *counters = localCounters;
+    if (bc->registers > TINYJS_VM_LOCAL_REGISTERS) {
+      heapRegisters.resize(bc->registers);
+      regs = &heapRegisters[0];
+    }
+    if (bc->locals > TINYJS_VM_LOCAL_REGISTERS) {
+      heapSlots.resize(bc->locals);
+      slots = &heapSlots[0];
+    }
+    if (bc->loops > TINYJS_VM_LOCAL_REGISTERS) {
+      heapCounters.resize(bc->loops);
+      counters = &heapCounters[0];
+    }
+    if (bc->locals) {
+      for (int i=0;i<bc->locals;i++) slots[i] = 0;
+      slots[0] = thisLink;
+      if (parameterCount > bc->parameters) parameterCount = bc->parameters;
+      for (int i=0;i<parameterCount;i++, parameters = parameters->nextSibling)
+        slots[1+i] = parameters;
+    }
+    size_t mark = temporaries.size();
+    int pc = 0;
+    const Instruction *ins = &bc->code[0];
+    try {
+#ifdef TINYJS_COMPUTED_GOTO
+      goto *labels[ins->op];
+#else
+      for (;;) {
+        ins = &bc->code[pc];
+        switch (ins->op) {
+#endif
+      VM_CASE(LOAD_INT) {
+        long val = bc->ints[ins->b];
+        if (val == (int)val) {
+          regs[ins->a] = Value::fromInt((int)val);
+        } else {
+          Variable *a = new Variable(TINYJS_BLANK_DATA, VARIABLE_INTEGER);
+          a->intData = val;
+          regs[ins->a] = temporary(a);
+        }
+      } VM_NEXT()
+      VM_CASE(LOAD_DOUBLE)
+        regs[ins->a] = Value::fromDouble(bc->doubles[ins->b]);
+        VM_NEXT()
+      VM_CASE(LOAD_STRING) {
+        Variable *literal = new Variable(TINYJS_BLANK_DATA, VARIABLE_STRING);
+        literal->setStringLiteral(bc->strings[ins->b]);
+        regs[ins->a] = temporary(literal);
+      } VM_NEXT()
+      VM_CASE(LOAD_TRUE)
+        regs[ins->a] = Value::fromInt(1);
+        VM_NEXT()
+      VM_CASE(LOAD_FALSE)
+        regs[ins->a] = Value::fromInt(0);
+        VM_NEXT()
+      VM_CASE(LOAD_NULL)
+        regs[ins->a] = Value::fromBits(TINYJS_VALUE_NULL);
+        VM_NEXT()
+      VM_CASE(LOAD_UNDEFINED)
+        regs[ins->a] = Value::fromBits(TINYJS_VALUE_UNDEFINED);
+        VM_NEXT()
+      VM_CASE(LOAD_NIL)
+        regs[ins->a] = Value((VariableLink*)0);
+        VM_NEXT()
+      VM_CASE(LOAD_NAME) {
+        const Name &name = bc->strings[ins->b];
+        VariableLink *a = findInScopes(name);
+        /* Variable doesn't exist! JavaScript says we should create it
+         * (we won't add it here. This is done in the assignment operator)*/
+        if (!a) a = temporary(new Variable(), name);
+        regs[ins->a] = a;
+      } VM_NEXT()
+      VM_CASE(LOAD_LOCAL) {
+        VariableLink *a = slots[ins->b];
+        if (!a) {
+          // not declared yet, so it may belong to a caller, or be global
+          const Name &name = bc->strings[ins->c];
+          a = findInScopes(name);
+          if (!a) a = temporary(new Variable(), name);
+        }
+        regs[ins->a] = a;
+      } VM_NEXT()
+      VM_CASE(GET_MEMBER) {
+        VariableLink *objectLink = VM_LINK(ins->b);
+        Variable *object = objectLink->var;
+        InlineCache &cache = bc->caches[ins->c];
+        Shape *shape = object->getShape();
+        int hit = -1;
+        if (shape) {
+          for (int i=0;i<cache.count;i++)
+            if (cache.shapes[i] == shape) {
+              hit = i;
+              break;
+            }
+        }
+        if (hit >= 0) {
+          regs[ins->a] = object->children->slots[cache.slots[hit]];
+          VM_NEXT()
+        }
+        VariableLink *child = getMember(objectLink, bc->strings[cache.name]);
+        object = objectLink->var; // a constant is copied before anything is added to it
+        // remember where it was, if it is one of the object's own properties
+        shape = object->getShape();
+        if (shape && cache.count < TINYJS_INLINE_CACHE_SIZE) {
+          std::vector<VariableLink*> &slots = object->children->slots;
+          for (int i=(int)slots.size()-1;i>=0;i--)
+            if (slots[i] == child) {
+              cache.shapes[cache.count] = shape->ref();
+              cache.slots[cache.count] = i;
+              cache.count++;
+              break;
+            }
+        }
+        regs[ins->a] = child;
+      } VM_NEXT()
+      VM_CASE(GET_INDEX) {
+        Variable *object = VM_LINK(ins->b)->var;
+        const Value &index = regs[ins->c];
+        VariableLink *element = index.isInt() ? object->getElement(index.getInt()) :
+                                index.isLink() ? object->getElement(index.getLink()->var) : 0;
+        if (!element) {
+          char buffer[TINYJS_NUMBER_BUFFER];
+          VM_LINK(ins->b)->copyIfConstant();
+          element = VM_LINK(ins->b)->var->findChildOrCreate(VM_LINK(ins->c)->var->getStringView(buffer));
+        }
+        regs[ins->a] = element;
+      } VM_NEXT()
+      VM_CASE(CHECK_FUNCTION) {
+        VariableLink *function = VM_LINK(ins->a);
+        if (!function->var->isFunction()) {
+          std::ostringstream msg;
+          msg << "Expecting '" << function->name.str() << "' to be a function";
+          throw new Exception(msg.str());
+        }
+      } VM_NEXT()
+      VM_CASE(ARGUMENT)
+        if (!regs[ins->a].isLink())
+          getRegisterLink(regs[ins->a]); // a new Variable, so it's already a copy
+        else if (regs[ins->a].getLink()->var->isBasic())
+          regs[ins->a] = temporary(regs[ins->a].getLink()->var->deepCopy()); // pass by value
+        VM_NEXT()
+      VM_CASE(CALL) {
+        VariableLink *function = VM_LINK(ins->b);
+        VariableLink *parent = VM_LINK(ins->b+1);
+        VariableLink *localArguments[TINYJS_VM_LOCAL_REGISTERS];
+        std::vector<VariableLink*> heapArguments;
+        VariableLink **arguments = localArguments;
+        if (ins->c > TINYJS_VM_LOCAL_REGISTERS) {
+          heapArguments.resize(ins->c);
+          arguments = &heapArguments[0];
+        }
+        for (int i=0;i<ins->c;i++)
+          arguments[i] = VM_LINK(ins->b+2+i);
+        regs[ins->a] = callFunction(function, parent ? parent->var : 0,
+                                    arguments, ins->c, bc->positions[pc]);
+      } VM_NEXT()
+      VM_CASE(NEW) {
+        VariableLink *objClassOrFunc = findInScopes(bc->strings[ins->b]);
+        if (!objClassOrFunc) {
+          TRACE("%s is not a valid class name", bc->strings[ins->b].str().c_str());
+          regs[ins->a+1] = temporary(new Variable());
+          VM_JUMP(ins->c)
+        }
+        Variable *obj = new Variable(TINYJS_BLANK_DATA, VARIABLE_OBJECT);
+        regs[ins->a+1] = temporary(obj);
+        if (!objClassOrFunc->var->isFunction()) {
+          obj->addChild(Name::getPrototype(), objClassOrFunc->var);
+          VM_JUMP(ins->c)
+        }
+        regs[ins->a] = objClassOrFunc;
+      } VM_NEXT()
+      VM_CASE(OBJECT)
+        regs[ins->a] = temporary(new Variable(TINYJS_BLANK_DATA, VARIABLE_OBJECT));
+        VM_NEXT()
+      VM_CASE(ADD_PROPERTY)
+        VM_LINK(ins->a)->var->addChild(bc->strings[ins->b], VM_LINK(ins->c)->var);
+        VM_NEXT()
+      VM_CASE(ARRAY)
+        regs[ins->a] = temporary(new Variable(TINYJS_BLANK_DATA, VARIABLE_ARRAY));
+        VM_NEXT()
+      VM_CASE(ADD_ELEMENT) {
+        char idx_str[TINYJS_NUMBER_BUFFER];
+        formatInteger(idx_str, ins->c);
+        VM_LINK(ins->a)->var->addChild(idx_str, VM_LINK(ins->b)->var);
+      } VM_NEXT()
+      VM_CASE(FUNCTION) {
+        Node *func = bc->functions[ins->b];
+        regs[ins->a] = temporary(createFunction(func), func->name);
+      } VM_NEXT()
+      VM_CASE(MOVE)
+        regs[ins->a] = regs[ins->b];
+        VM_NEXT()
+      VM_CASE(NOT)
+      VM_CASE(NEGATE) {
+        NumericValue va;
+        if (regs[ins->b].getNumeric(va)) {
+          if (ins->op==OP_NOT)
+            NumericValue::maths(va, NumericValue(0), LEXER_EQUAL, va);
+          else
+            NumericValue::maths(NumericValue(0), va, '-', va);
+          regs[ins->a] = Value::fromNumeric(va);
+        } else
+          regs[ins->a] = temporary(VM_LINK(ins->b)->var->unaryOp(ins->op==OP_NOT ? '!' : '-'));
+      } VM_NEXT()
+      VM_MATHS(ADD, '+')
+      VM_MATHS(SUB, '-')
+      VM_MATHS(MUL, '*')
+      VM_MATHS(DIV, '/')
+      VM_MATHS(MOD, '%')
+      VM_MATHS(BITAND, '&')
+      VM_MATHS(BITOR, '|')
+      VM_MATHS(BITXOR, '^')
+      VM_MATHS(EQUAL, LEXER_EQUAL)
+      VM_MATHS(NEQUAL, LEXER_NEQUAL)
+      VM_CASE(TYPEEQUAL)
+      VM_CASE(NTYPEEQUAL) {
+        int ta = getNumericType(regs[ins->b]);
+        int tb = getNumericType(regs[ins->c]);
+        if (ta>=0 && tb>=0) {
+          bool eql = ta==tb;
+          if (eql) {
+            NumericValue va, vb;
+            regs[ins->b].getNumeric(va);
+            regs[ins->c].getNumeric(vb);
+            NumericValue::maths(va, vb, LEXER_EQUAL, va);
+            eql = va.intData!=0;
+          }
+          regs[ins->a] = Value::fromInt(ins->op==OP_TYPEEQUAL ? eql : !eql);
+        } else
+          regs[ins->a] = temporary(VM_LINK(ins->b)->var->mathsOp(VM_LINK(ins->c)->var,
+                                   ins->op==OP_TYPEEQUAL ? LEXER_TYPEEQUAL : LEXER_NTYPEEQUAL));
+      } VM_NEXT()
+      VM_MATHS(LESS, '<')
+      VM_MATHS(LEQUAL, LEXER_LEQUAL)
+      VM_MATHS(GREATER, '>')
+      VM_MATHS(GEQUAL, LEXER_GEQUAL)
+      VM_CASE(POSTINC)
+      VM_CASE(POSTDEC) {
+        VariableLink *a = VM_LINK(ins->b);
+        int op = ins->op==OP_POSTINC ? '+' : '-';
+        NumericValue value;
+        if (a->var->getNumeric(value) && !a->var->isNull()) {
+          // the old value goes in the register, so the variable can change in place
+          regs[ins->a] = Value::fromNumeric(value);
+          if (!a->var->mathsOpInPlace(NumericValue(1), op)) {
+            NumericValue::maths(value, NumericValue(1), op, value);
+            a->replaceWith(new Variable(value));
+          }
+        } else {
+          Variable one(1);
+          Variable *res = a->var->mathsOp(&one, op);
+          regs[ins->a] = temporary(a->var);
+          a->replaceWith(res);
+        }
+      } VM_NEXT()
+      VM_CASE(INCREMENT)
+      VM_CASE(DECREMENT) {
+        VariableLink *a = VM_LINK(ins->a);
+        int op = ins->op==OP_INCREMENT ? '+' : '-';
+        if (!a->var->mathsOpInPlace(NumericValue(1), op)) {
+          Variable one(1);
+          a->replaceWith(a->var->mathsOp(&one, op));
+        }
+      } VM_NEXT()
+      VM_CASE(LSHIFT) {
+        int a = regs[ins->b].toInt(), shift = regs[ins->c].toInt();
+        regs[ins->a] = Value::fromInt(a << shift);
+      } VM_NEXT()
+      VM_CASE(RSHIFT) {
+        int a = regs[ins->b].toInt(), shift = regs[ins->c].toInt();
+        regs[ins->a] = Value::fromInt(a >> shift);
+      } VM_NEXT()
+      VM_CASE(URSHIFT) {
+        int a = regs[ins->b].toInt(), shift = regs[ins->c].toInt();
+        regs[ins->a] = Value::fromInt(((unsigned int)a) >> shift);
+      } VM_NEXT()
+      VM_CASE(AND_TEST)
+        if (!regs[ins->a].getBool()) VM_JUMP(ins->c)
+        VM_NEXT()
+      VM_CASE(OR_TEST)
+        if (regs[ins->a].getBool()) VM_JUMP(ins->c)
+        VM_NEXT()
+      VM_CASE(AND_BOOL)
+      VM_CASE(OR_BOOL) {
+        int newa = regs[ins->a].getBool();
+        int newb = regs[ins->b].getBool();
+        regs[ins->a] = Value::fromInt(ins->op==OP_AND_BOOL ? (newa & newb) : (newa | newb));
+      } VM_NEXT()
+      VM_CASE(JUMP)
+        VM_JUMP(ins->c)
+      VM_CASE(JUMP_IF_FALSE)
+        if (!regs[ins->a].getBool()) VM_JUMP(ins->c)
+        VM_NEXT()
+      VM_CASE(BRANCH_FALSE) {
+        bool cond = regs[ins->a].getBool();
+        releaseTemporaries(mark);
+        if (!cond) VM_JUMP(ins->c)
+      } VM_NEXT()
+      VM_CASE(ASSIGN_GLOBAL) {
+        VariableLink *lhs = VM_LINK(ins->a);
+        /* If we're assigning to this and we don't have a parent,
+         * add it to the symbol table root as per JavaScript. */
+        if (!lhs->owned) {
+          if (!lhs->name.empty())
+            regs[ins->a] = root->addChildNoDup(lhs->name, lhs->var);
+          else
+            TRACE("Trying to assign to an un-named type\n");
+        }
+      } VM_NEXT()
+      VM_CASE(ASSIGN) {
+        VariableLink *lhs = VM_LINK(ins->a);
+        const Value &rhs = regs[ins->b];
+        if (rhs.isLink()) {
+          lhs->replaceWith(rhs.getLink());
+        } else {
+          // a number can be stored straight into a number nothing else is using
+          Variable *var = lhs->var;
+          NumericValue value;
+          if (!rhs.isNull() && rhs.getNumeric(value) && var->getRefs()==1 && var->isBasic() &&
+              (var->isInt() || var->isDouble() || var->isUndefined()))
+            var->setNumeric(value);
+          else
+            lhs->replaceWith(rhs.createVariable());
+        }
+      } VM_NEXT()
+      VM_CASE(ASSIGN_ADD)
+      VM_CASE(ASSIGN_SUB) {
+        VariableLink *lhs = VM_LINK(ins->a);
+        int op = ins->op==OP_ASSIGN_ADD ? '+' : '-';
+        NumericValue value;
+        if (!regs[ins->b].getNumeric(value) || !lhs->var->mathsOpInPlace(value, op))
+          lhs->replaceWith(lhs->var->mathsOp(VM_LINK(ins->b)->var, op));
+      } VM_NEXT()
+      VM_CASE(DECLARE)
+        regs[ins->a] = scopes.back()->findChildOrCreate(bc->strings[ins->b]);
+        VM_NEXT()
+      VM_CASE(DECLARE_LOCAL)
+        if (!slots[ins->c])
+          slots[ins->c] = scopes.back()->findChildOrCreate(bc->strings[ins->b]);
+        regs[ins->a] = slots[ins->c];
+        VM_NEXT()
+      VM_CASE(DECLARE_MEMBER)
+        regs[ins->a] = VM_LINK(ins->a)->var->findChildOrCreate(bc->strings[ins->b]);
+        VM_NEXT()
+      VM_CASE(DEFINE) {
+        Node *func = bc->functions[ins->a];
+        if (func->name == TINYJS_TEMP_NAME)
+          TRACE("Functions defined at statement-level are meant to have a name\n");
+        else {
+          VariableLink *link = scopes.back()->addChildNoDup(func->name, createFunction(func));
+          if (ins->b >= 0) slots[ins->b] = link;
+        }
+      } VM_NEXT()
+      VM_CASE(RELEASE)
+        releaseTemporaries(mark);
+        VM_NEXT()
+      VM_CASE(LOOP_START)
+        counters[ins->a] = TINYJS_LOOP_MAX_ITERATIONS;
+        VM_NEXT()
+      VM_CASE(LOOP_NEXT)
+        if (counters[ins->a]-- > 0) VM_JUMP(ins->c)
+        VM_NEXT()
+      VM_CASE(LOOP_END)
+        if (counters[ins->a] <= 0) {
+          root->trace();
+          TRACE("%s Loop exceeded %d iterations at %s\n", ins->c=='w' ? "WHILE" : "FOR",
+                TINYJS_LOOP_MAX_ITERATIONS, code->getPosition(bc->positions[pc]).c_str());
+          throw new Exception("LOOP_ERROR");
+        }
+        VM_NEXT()
+      VM_CASE(RETURN) {
+        if (frame)
+          frame->setReturnVar(ins->a>=0 ? VM_LINK(ins->a)->var : 0);
+        else
+          TRACE("RETURN statement, but not in a function.\n");
+        releaseTemporaries(mark);
+        return 0;
+      }
+      VM_CASE(RESULT)
+        return VM_LINK(ins->a);
+      VM_CASE(END)
+        releaseTemporaries(mark);
+        return 0;
+#ifndef TINYJS_COMPUTED_GOTO
+          default:
+            ASSERT(0);
+            return 0;
+        }
+      }
+#endif
+    } catch (Exception *e) {
+      if (errorPosition) *errorPosition = bc->positions[pc];
+      throw;
+    }
+}
+
+}; // namespace TinyJS
@@ -0,0 +1,265 @@
+/*
+ * TinyJS
+ *
+ * A single-file Javascript-alike engine
+ *
+ * - Bytecode compiler and register based virtual machine
+ *
+ * Authored By Gordon Williams <gw@pur3.co.uk>
+ * Additional Coding By Marco Lizza <marco.lizza@gmail.com>
+ *
+ * Copyright (C) 2009 Pur3 Ltd
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TINYJS_VM_H
+#define TINYJS_VM_H
+
+#include "TinyJS_AST.h"
+#include <map>
+#include <string.h>
+
+#if defined(__GNUC__)
+  // Use 'labels as values' to jump straight to the next instruction
+  #define TINYJS_COMPUTED_GOTO
+#endif
+
+namespace TinyJS {
+
+/* Every register holds a VariableLink, just like the results of base() and friends.
+   Operands are registers unless they index one of the constant tables of the
+   Bytecode, and jumps are to the index of an instruction.
+
+   Slots hold the links of a function's own locals, which are resolved when it is
+   compiled: slot 0 is 'this', then come the parameters, then the names given to
+   'var' and 'function' in the body. As scopes are dynamic (a function can see the
+   locals of whatever called it), every other name is looked up at runtime, as are
+   locals whose 'var' hasn't been run yet. */
+#define TINYJS_OPCODES(X) \
+    X(LOAD_INT)        /* a = ints[b]                                       */ \
+    X(LOAD_DOUBLE)     /* a = doubles[b]                                    */ \
+    X(LOAD_STRING)     /* a = strings[b]                                    */ \
+    X(LOAD_TRUE)       /* a = true                                          */ \
+    X(LOAD_FALSE)      /* a = false                                         */ \
+    X(LOAD_NULL)       /* a = null                                          */ \
+    X(LOAD_UNDEFINED)  /* a = undefined                                     */ \
+    X(LOAD_NIL)        /* a = no link at all (a call without a parent)      */ \
+    X(LOAD_NAME)       /* a = strings[b], looked up in the scopes           */ \
+    X(LOAD_LOCAL)      /* a = slots[b], or strings[c] looked up if unset    */ \
+    X(GET_MEMBER)      /* a = b.strings[caches[c].name]                     */ \
+    X(GET_INDEX)       /* a = b[c]                                          */ \
+    X(CHECK_FUNCTION)  /* throw unless a is a function                      */ \
+    X(ARGUMENT)        /* a = a, copied if it is passed by value            */ \
+    X(CALL)            /* a = b(b+2 ... b+2+c) with b+1 as 'this'           */ \
+    X(NEW)             /* a+1 = new strings[b], a = constructor, or jump c  */ \
+    X(OBJECT)          /* a = {}                                            */ \
+    X(ADD_PROPERTY)    /* a.strings[b] = c                                  */ \
+    X(ARRAY)           /* a = []                                            */ \
+    X(ADD_ELEMENT)     /* a[c] = b                                          */ \
+    X(FUNCTION)        /* a = functions[b]                                  */ \
+    X(MOVE)            /* a = b                                             */ \
+    X(NOT)             /* a = !b                                            */ \
+    X(NEGATE)          /* a = -b                                            */ \
+    X(ADD)             /* a = b + c                                         */ \
+    X(SUB)             /* a = b - c                                         */ \
+    X(MUL)             /* a = b * c                                         */ \
+    X(DIV)             /* a = b / c                                         */ \
+    X(MOD)             /* a = b % c                                         */ \
+    X(BITAND)          /* a = b & c                                         */ \
+    X(BITOR)           /* a = b | c                                         */ \
+    X(BITXOR)          /* a = b ^ c                                         */ \
+    X(EQUAL)           /* a = b == c                                        */ \
+    X(NEQUAL)          /* a = b != c                                        */ \
+    X(TYPEEQUAL)       /* a = b === c                                       */ \
+    X(NTYPEEQUAL)      /* a = b !== c                                       */ \
+    X(LESS)            /* a = b < c                                         */ \
+    X(LEQUAL)          /* a = b <= c                                        */ \
+    X(GREATER)         /* a = b > c                                         */ \
+    X(GEQUAL)          /* a = b >= c                                        */ \
+    X(POSTINC)         /* a = b++                                           */ \
+    X(POSTDEC)         /* a = b--                                           */ \
+    X(INCREMENT)       /* a++, when the old value isn't needed              */ \
+    X(DECREMENT)       /* a--, when the old value isn't needed              */ \
+    X(LSHIFT)          /* a = b << c                                        */ \
+    X(RSHIFT)          /* a = b >> c                                        */ \
+    X(URSHIFT)         /* a = b >>> c                                       */ \
+    X(AND_TEST)        /* if !a, jump to c (leaving a as the result)        */ \
+    X(OR_TEST)         /* if a, jump to c (leaving a as the result)         */ \
+    X(AND_BOOL)        /* a = (bool)a & (bool)b                             */ \
+    X(OR_BOOL)         /* a = (bool)a | (bool)b                             */ \
+    X(JUMP)            /* jump to c                                         */ \
+    X(JUMP_IF_FALSE)   /* if !a, jump to c                                  */ \
+    X(BRANCH_FALSE)    /* free temporaries, then if !a, jump to c           */ \
+    X(ASSIGN_GLOBAL)   /* if a is not stored anywhere, add it to root       */ \
+    X(ASSIGN)          /* a = b                                             */ \
+    X(ASSIGN_ADD)      /* a += b                                            */ \
+    X(ASSIGN_SUB)      /* a -= b                                            */ \
+    X(DECLARE)         /* a = var strings[b] in the current scope           */ \
+    X(DECLARE_LOCAL)   /* as DECLARE, and keep a in slots[c]                */ \
+    X(DECLARE_MEMBER)  /* a = a.strings[b], creating it if needed           */ \
+    X(DEFINE)          /* function functions[a] in the current scope (and   */ \
+                       /* in slots[b], if b>=0)                             */ \
+    X(RELEASE)         /* free the temporaries of the statement             */ \
+    X(LOOP_START)      /* counters[a] = TINYJS_LOOP_MAX_ITERATIONS          */ \
+    X(LOOP_NEXT)       /* if counters[a]-- > 0, jump to c                   */ \
+    X(LOOP_END)        /* throw if counters[a] ran out (c = 'w' or 'f')     */ \
+    X(RETURN)          /* return a (or nothing if a<0)                      */ \
+    X(RESULT)          /* stop, with a as the result                        */ \
+    X(END)             /* stop                                              */
+
+enum OPCODES {
+#define TINYJS_OPCODE_ENUM(NAME) OP_##NAME,
+    TINYJS_OPCODES(TINYJS_OPCODE_ENUM)
+#undef TINYJS_OPCODE_ENUM
+    OP_COUNT
+};
+
+/// Number of shapes an InlineCache remembers
+#define TINYJS_INLINE_CACHE_SIZE 4
+
+/** Remembers where a property was found on the objects an OP_GET_MEMBER has seen,
+    keyed by their Shape. One shape is the usual (monomorphic) case, and after
+    TINYJS_INLINE_CACHE_SIZE shapes new ones are just looked up the slow way. */
+class InlineCache
+{
+public:
+    int name; ///< Index in Bytecode::strings of the property's name
+    int count; ///< Number of entries used
+    Shape *shapes[TINYJS_INLINE_CACHE_SIZE]; ///< Shapes seen (ref'd, so they can't be reused)
+    int slots[TINYJS_INLINE_CACHE_SIZE]; ///< Index in Variable::slots of the property, for each shape
+};
+
+/* Doubles are kept in a Value as they are. Everything else goes in the bits of a
+   negative quiet NaN, with the top 16 bits saying what it is (so pointers have to fit
+   in 48 bits, as they do on x86-64 and ARM64). Real NaNs are all stored as the one
+   positive quiet NaN, so they can't be mistaken for anything else. */
+#define TINYJS_VALUE_TAG_MASK  0xFFFF000000000000ULL
+#define TINYJS_VALUE_INT       0xFFF9000000000000ULL
+#define TINYJS_VALUE_NULL      0xFFFA000000000000ULL
+#define TINYJS_VALUE_UNDEFINED 0xFFFB000000000000ULL
+#define TINYJS_VALUE_LINK      0xFFFC000000000000ULL
+#define TINYJS_VALUE_NAN       0x7FF8000000000000ULL
+
+/** What a register of the VM holds: a link, like the ones base() and friends return,
+    or a number, null or undefined held in the register itself (NaN boxed). Maths on
+    those doesn't need a Variable, so it doesn't allocate anything. They only become
+    Variables (see Interpreter::getRegisterLink) when they are stored somewhere, or
+    used by something that needs a link. */
+class Value
+{
+public:
+    Value() {} ///< Uninitialised, as registers are until they are written
+    Value(VariableLink *link) : bits(TINYJS_VALUE_LINK | (size_t)link) {} ///< A link (or no link at all)
+
+    static Value fromInt(int val) { Value v; v.bits = TINYJS_VALUE_INT | (unsigned int)val; return v; }
+    static Value fromDouble(double val) {
+      Value v;
+      if (val != val) v.bits = TINYJS_VALUE_NAN;
+      else memcpy(&v.bits, &val, sizeof(val));
+      return v;
+    }
+    static Value fromNumeric(const NumericValue &val) { return val.isDouble ? fromDouble(val.doubleData) : fromInt(val.intData); }
+    static Value fromBits(unsigned long long bits) { Value v; v.bits = bits; return v; }
+
+    bool isLink() const { return (bits & TINYJS_VALUE_TAG_MASK) == TINYJS_VALUE_LINK; }
+    bool isInt() const { return (bits & TINYJS_VALUE_TAG_MASK) == TINYJS_VALUE_INT; }
+    bool isDouble() const { return bits < TINYJS_VALUE_INT; }
+    bool isNull() const { return bits == TINYJS_VALUE_NULL; }
+    bool isUndefined() const { return bits == TINYJS_VALUE_UNDEFINED; }
+
+    VariableLink *getLink() const { return (VariableLink*)(size_t)(bits & ~TINYJS_VALUE_TAG_MASK); }
+    int getInt() const { return (int)(unsigned int)bits; }
+    double getDouble() const { double val; memcpy(&val, &bits, sizeof(val)); return val; }
+    bool getNumeric(NumericValue &val) const; ///< As Variable::getNumeric, for whatever this holds
+    bool getBool() const; ///< As Variable::getBool, for whatever this holds
+    int toInt() const; ///< As Variable::getInt, for whatever this holds
+    int getType() const; ///< The VARIABLE_TYPEMASK flags of a value held here (not a link)
+    Variable *createVariable() const; ///< A new Variable for a value held here (not a link)
+
+    unsigned long long bits;
+};
+
+class Instruction
+{
+public:
+    int op; ///< One of OPCODES
+    int a, b, c; ///< Registers, constants or jump targets - see TINYJS_OPCODES
+};
+
+/// Code compiled for the virtual machine, owned by a CompiledCode
+class Bytecode
+{
+public:
+    Bytecode();
+    ~Bytecode();
+
+    std::vector<Instruction> code;
+    std::vector<int> positions; ///< Position in the source of each instruction (for errors)
+    std::vector<long> ints;
+    std::vector<double> doubles;
+    std::vector<Name> strings; ///< String literals, names and property names
+    std::vector<Node*> functions; ///< Function literals, which belong to the syntax tree
+    std::vector<InlineCache> caches; ///< One for each OP_GET_MEMBER
+    int registers; ///< Number of registers a call needs
+    int locals; ///< Number of slots a call needs (0 outside of functions)
+    int parameters; ///< Number of parameters the slots were resolved for
+    int loops; ///< Number of loop counters a call needs
+
+    static const char *getOpcodeName(int op);
+    void dump() const; ///< Write out a listing of the code using TRACE
+};
+
+/// Turns a syntax tree into Bytecode
+class Compiler
+{
+public:
+    Compiler(Bytecode *bytecode);
+
+    void compileProgram(Node *root); ///< Statements, as passed to execute
+    void compileExpressions(Node *root); ///< Expressions, as passed to evaluateComplex
+    void compileBody(Node *root, const std::vector<std::string> &parameters); ///< Body of a function
+
+protected:
+    Bytecode *bc;
+    int nextRegister; ///< First free register
+    int position; ///< Position of the node being compiled
+    std::map<std::string, int> stringIndex; ///< So each string is only stored once
+    std::map<std::string, int> locals; ///< Slots of the function's locals, see TINYJS_OPCODES
+
+    int emit(int op, int a = 0, int b = 0, int c = 0);
+    int here() const;
+    void patch(int instruction, int target);
+    int allocate();
+    void release(int reg);
+    int string(const std::string &str);
+    int cache(const std::string &name); ///< Add an InlineCache for the given property
+    int local(const std::string &name); ///< Slot of a local, or -1
+    void addLocal(const std::string &name);
+    void findLocals(Node *node); ///< Give slots to the 'var' and 'function' names in a body
+
+    void statement(Node *node);
+    void expression(Node *node, int dst);
+    void discarded(Node *node, int dst); ///< An expression whose value isn't used
+    void arguments(Node *node, int base);
+};
+
+}; // namespace TinyJS
+
+#endif
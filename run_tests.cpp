@@ -39,6 +39,7 @@
 #include <string>
 #include <sstream>
 #include <stdio.h>
+#include <string.h>
 
 #ifdef MTRACE
   #include <mcheck.h>
@@ -192,8 +193,12 @@ void memtracing_kill() {
 #endif // INSANE_MEMORY_DEBUG
 
 
-bool run_test(const char *filename) {
-  printf("TEST %s ", filename);
+const int engines[] = { TinyJS::ENGINE_LEGACY, TinyJS::ENGINE_AST, TinyJS::ENGINE_VM };
+const char *engineNames[] = { "legacy", "ast", "vm" };
+const int engineCount = sizeof(engines)/sizeof(engines[0]);
+
+bool run_test(const char *filename, int engine) {
+  printf("TEST %s (%s) ", filename, engineNames[engine]);
   struct stat results;
   if (!stat(filename, &results) == 0) {
     printf("Cannot stat file! '%s'\n", filename);
@@ -213,6 +218,7 @@ bool run_test(const char *filename) {
   fclose(file);
 
   TinyJS::Interpreter s;
+  s.setEngine(engines[engine]);
   TinyJS::registerFunctions(&s);
   TinyJS::registerMathFunctions(&s);
   s.root->addChild("result", new TinyJS::Variable("0",TinyJS::VARIABLE_INTEGER));
@@ -227,7 +233,7 @@ bool run_test(const char *filename) {
     printf("PASS\n");
   else {
     char fn[64];
-    sprintf(fn, "%s.fail.js", filename);
+    sprintf(fn, "%s.%s.fail.js", filename, engineNames[engine]);
     FILE *f = fopen(fn, "wt");
     if (f) {
       std::ostringstream symbols;
@@ -243,6 +249,25 @@ bool run_test(const char *filename) {
   return pass;
 }
 
+/// Print the bytes used by each kind of value (see Variable::getMemoryUsed)
+void report_sizes() {
+  TinyJS::Interpreter s;
+  TinyJS::registerFunctions(&s);
+  s.execute("var _undefined; var _int = 42; var _double = 4.2; var _short = 'short';"
+            "var _long = 'a string that is too long to fit in a std::string';"
+            "var _function = function (a, b) { return a+b; }; var _object = {};"
+            "var _object4 = { a:1, b:2, c:3, d:4 }; var _array10 = [0,1,2,3,4,5,6,7,8,9];"
+            "var _object64 = {}; for (var i=0;i<64;i++) _object64['p'+i] = i;");
+  const char *names[] = { "_undefined", "_int", "_double", "_short", "_long", "_function",
+                          "_object", "_object4", "_array10", "_object64" };
+  printf("sizeof(Variable) = %d, sizeof(VariableLink) = %d\n",
+         (int)sizeof(TinyJS::Variable), (int)sizeof(TinyJS::VariableLink));
+  for (size_t i=0;i<sizeof(names)/sizeof(names[0]);i++)
+    printf("%-12s %6d bytes\n", names[i]+1, (int)s.root->getParameter(names[i])->getMemoryUsed());
+  TinyJS::Variable *native = s.getScriptVariable("String.indexOf");
+  if (native) printf("%-12s %6d bytes\n", "native", (int)native->getMemoryUsed());
+}
+
 int main(int argc, char **argv)
 {
 #ifdef MTRACE
@@ -255,8 +280,16 @@ int main(int argc, char **argv)
   printf("USAGE:\n");
   printf("   ./run_tests test.js       : run just one test\n");
   printf("   ./run_tests               : run all tests\n");
+  printf("   ./run_tests -sizes        : show the bytes used by each kind of value\n");
+  if (argc==2 && !strcmp(argv[1], "-sizes")) {
+    report_sizes();
+    return 0;
+  }
   if (argc==2) {
-    return !run_test(argv[1]);
+    bool pass = true;
+    for (int e=0;e<engineCount;e++)
+      if (!run_test(argv[1], e)) pass = false;
+    return !pass;
   }
 
   int test_num = 1;
@@ -271,9 +304,11 @@ int main(int argc, char **argv)
     if (!f) break;
     fclose(f);
 
-    if (run_test(fn))
-      passed++;
-    count++;
+    for (int e=0;e<engineCount;e++) {
+      if (run_test(fn, e))
+        passed++;
+      count++;
+    }
     test_num++;
   }
 
@@ -0,0 +1,6 @@
+// returning from inside loops, which carry on round after the first time
+function findWhile(n) { var i=0; while (i<100) { if (i==n) return i*2; i++; } return -1; }
+function findFor(n) { for (var i=0;i<100;i++) { if (i==n) { return i*3; } } return -1; }
+var total = 0;
+for (var j=0;j<10;j++) total += findWhile(j) + findFor(j);
+result = findWhile(7)==14 && findFor(7)==21 && findWhile(200)==-1 && findFor(200)==-1 && total==225;
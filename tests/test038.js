@@ -0,0 +1,12 @@
+// locals are resolved when a function is compiled - check names that aren't declared yet
+var x = 1;
+function inner() { return y * 10; } // sees the local of whatever called it
+function outer(a, a2) {
+  var before = x; // global, as the local isn't declared yet
+  var x = 2;
+  var y = a + a2;
+  function twice(n) { return n*2; }
+  return before + x + inner() + twice(a);
+}
+function noParent() { return this; }
+result = outer(3, 4)==(1 + 2 + 70 + 6) && x==1 && noParent()==undefined;
@@ -0,0 +1,12 @@
+// reading the same property of objects with different layouts
+function getX(p) { return p.x; }
+function setX(p, v) { p.x = v; }
+var objs = [ {x:1}, {y:0, x:2}, {x:3, y:0}, {z:0, y:0, x:4}, {a:0, x:5}, {b:0, x:6}, {x:7} ];
+var sum = 0;
+for (var i=0;i<7;i++) { setX(objs[i], getX(objs[i]) * 10); sum += getX(objs[i]); }
+// an object too big to have a shape
+var big = {};
+for (var i=0;i<40;i++) big["p"+i] = i;
+big.x = 8;
+var another = { x:9 };
+result = sum==280 && getX(big)==8 && big.p39==39 && getX(another)==9 && getX({})==undefined;
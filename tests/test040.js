@@ -0,0 +1,12 @@
+// objects used as maps - lots of keys, still kept in the order they were added
+var map = {};
+for (var i=0;i<200;i++) map["k"+(i*7%200)] = i;
+var ok = true;
+for (var i=0;i<200;i++) if (map["k"+(i*7%200)]!=i) ok = false;
+map.k3 = "three";
+var json = JSON.stringify(map, undefined);
+// renumbering a big array keeps lookups by index working
+var arr = [];
+for (var i=0;i<50;i++) arr[i] = i;
+arr.remove(10);
+result = ok && map.k3=="three" && json.indexOf("\"k0\"")<json.indexOf("\"k7\"") && json.indexOf("\"k7\"")<json.indexOf("\"k14\"") && arr[10]==11 && arr[48]==49;
@@ -0,0 +1,18 @@
+// arrays - dense, with holes, and sparse
+var a = [];
+for (var i=0;i<1000;i++) a[i] = i*2;
+var sum = 0;
+for (var i=0;i<a.length;i++) sum += a[i];
+var holey = [1,2,3];
+holey[6] = 7;
+var sparse = [];
+sparse[100000] = 1;
+sparse[5] = 5;
+var named = [];
+named["007"] = 7;
+named[3] = 3;
+a.remove(0);
+result = a.length==999 && sum==999000 && a[0]==2 && a[998]==1998 &&
+         holey.length==7 && holey[6]==7 && holey[4]==undefined &&
+         sparse.length==100001 && sparse[5]==5 && sparse[100000]==1 &&
+         named.length==8 && named[3]==3 && named["007"]==7 && named[7]==undefined;
@@ -0,0 +1,21 @@
+// updating numbers in place mustn't change anything else holding the same value
+var a = 5;
+var b = a;
+a += 2;
+b++;
+var c = 1.5;
+c -= 0.5;
+var d = c++;
+var arr = [1, 2];
+var e = arr[0];
+arr[0] += 10;
+var s = 0;
+for (var i=0;i<10;i++) s += i;
+var n = 3;
+n--;
+var str = "x";
+str += 1;
+var u;
+u += 1;
+result = a==7 && b==6 && c==2 && d==1 && arr[0]==11 && e==1 && s==45 && n==2 && str=="x1" &&
+         u==1 && -n==-2 && !0 && !n==false;
@@ -0,0 +1,14 @@
+// numbers, null and undefined held in VM registers must behave as Variables do
+var a = 2 + 3 * 4;
+var b = 7 / 2.0;
+var c = (1 << 4) >> 2;
+var d = -8 >>> 28;
+var n = null;
+var u;
+function twice(x) { x = x * 2; return x; }
+var t = 10;
+var e = twice(t);
+var arr = [1, 2.5, null];
+result = a==14 && b==3.5 && c==4 && d==15 && n===null && u===undefined && !(n===u) &&
+         1===1 && !(1===1.5) && 2.5===2.5 && !(0===null) && e==20 && t==10 &&
+         arr[1]*2==5 && arr[2]===null && twice(1.25)==2.5 && (1 && 0)==0;
@@ -0,0 +1,18 @@
+// values changing kind, and copies of them, keep the right contents
+var a = "a string that is long enough not to fit in a std::string";
+var b = a;
+a = 5;
+a += 0.5;
+var f = function (x) { return x*2; };
+var g = f;
+g = "g";
+var o = { s:"", n:1 };
+o.s = o.s + "x";
+o.n = "one";
+var copy = o.clone();
+copy.s = "y";
+var arr = [1, "two", 3.5];
+arr[1] = arr[1] + arr[0];
+var e = "";
+result = a==5.5 && b.length==56 && f(2)==4 && g=="g" && o.s=="x" && o.n=="one" &&
+         copy.s=="y" && copy.n=="one" && arr[1]=="two1" && e=="" && e.length==0;
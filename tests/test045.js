@@ -0,0 +1,15 @@
+// names made at runtime find the same properties as names in the source
+var o = { ab : 1, "c d" : 2 };
+var k = "a";
+k = k + "b";
+o[k] = o[k] + 10;
+var arr = [];
+arr["1"] = "one";
+arr["01"] = "zero one";
+var big = {};
+for (var i=0;i<50;i++) big["p"+i] = i;
+big.p7 = 70;
+function Thing() { this.x = 3; }
+var t = new Thing();
+result = o.ab==11 && o["c d"]==2 && arr[1]=="one" && arr["01"]=="zero one" &&
+         big.p7==70 && big["p4"+"9"]==49 && t.x==3 && t["x"]==3;
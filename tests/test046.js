@@ -0,0 +1,8 @@
+// lexing - reserved words, names that start with them, numbers, strings and comments
+var iffy = 1, newer = 2, format = 3, variable = 4, doit = 5, undefinedx = 6, _else = 7;
+/* a block comment */ var sum = iffy+newer+format+variable+doit+undefinedx+_else; // a line comment
+/**/ var hex = 0x1F, oct = 017, flt = 1.5, exp = 15e-1;
+var dq = "a \"quoted\" \\ string\n", sq = 'it\'s \x41\101\t';
+var wordy = true && !false && null==undefined;
+
+result = sum==28 && hex==31 && flt==exp && dq.length==20 && oct==15 && sq=='it\'s AA\t' && wordy;
@@ -0,0 +1,10 @@
+// lexing long runs - whitespace, comments, identifiers and strings longer than 32 characters
+/*****************************************************************************
+ * a block comment with * and / inside it, ending in a few stars            */
+var aVeryLongIdentifierNameThatGoesOnForMoreThanThirtyTwoChars_0123456789 = 1;                                        // line comment
+var s = "a string that is longer than thirty two characters, with an \"escape\" near the end";
+var t = 'another string that is long enough to cover a whole vector, and then \'some\' more';
+/**/var u = "";/* */
+
+result = aVeryLongIdentifierNameThatGoesOnForMoreThanThirtyTwoChars_0123456789==1 &&
+         s.length==81 && s.charAt(67)=='"' && t.length==80 && t.charAt(74)=="'" && u=="";
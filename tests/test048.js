@@ -0,0 +1,7 @@
+// functions keep hold of the source they were defined in, after the code that defined them has gone
+exec("function made(a) { var t = 0; for (var i=0;i<a;i++) { t += i; } return t; }");
+exec("var outer = function(x) { function inner(y) { return y*2; } var n = 0; while (n < 3) { n++; x = inner(x); } return x; };");
+var copy = made;
+function local(s) { return s + "!"; }
+
+result = made(5)==10 && copy(4)==6 && outer(1)==8 && local("hi")=="hi!" && made(0)==0;
@@ -0,0 +1,9 @@
+// numbers are written with the fewest digits that read back the same, as JavaScript does
+var third = 1.0/3;
+var o = {};
+o[0.5] = "half";
+
+result = ""+1.5=="1.5" && ""+0.1=="0.1" && ""+third=="0.3333333333333333" && ""+(-2.5)=="-2.5" &&
+         ""+2.0=="2" && ""+1e21=="1e+21" && ""+1.5e-7=="1.5e-7" && ""+0.000001=="0.000001" &&
+         ""+100=="100" && ""+(-12345)=="-12345" && o["0.5"]=="half" &&
+         Integer.parseInt("42")==42 && Integer.parseInt("-7")==-7 && Integer.parseInt("0x1F")==31;
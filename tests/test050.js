@@ -0,0 +1,13 @@
+// long strings are joined without copying, and behave just like any other string
+var line = "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ\n";
+var s = "";
+for (var i=0;i<1000;i++) s = s + line;
+var t = s;
+s = s + "end";
+var u = "start" + t;
+var copy = "";
+for (var i=0;i<1000;i++) copy += line;
+
+result = s.length==63003 && t.length==63000 && u.length==63005 &&
+         t==copy && s!=t && s.charAt(62999)=="\n" && s.charAt(63000)=="e" &&
+         u.substring(0,6)=="start0" && s.indexOf("end")==63000 && t.indexOf("Z\n0")==61;
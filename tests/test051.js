@@ -0,0 +1,13 @@
+// string functions work on the string's own characters, and numbers are turned into strings on the way
+var s = "one,two,three";
+var parts = s.split(",");
+var joined = parts.join("-");
+var o = { "1" : "a", "x2" : "b" };
+var n = 12345;
+var k = "x" + 2;
+var mixed = [1,2.5,"c"];
+
+result = s.charAt(4)=="t" && s.charAt(13)=="" && s.charCodeAt(0)==111 && s.indexOf("three")==8 && s.indexOf("four")==-1 &&
+         s.substring(4,7)=="two" && parts.length==3 && parts[2]=="three" && joined=="one-two-three" &&
+         mixed.join(",")=="1,2.5,c" && "b"<"ba" && "ab"<"b" && !("b"<"b") && "b">="b" && "abc"=="abc" && "abc"!="abd" &&
+         o[1]=="a" && o[k]=="b" && ""+n=="12345" && Integer.valueOf("A")==65 && charToInt("B")==66;
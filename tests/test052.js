@@ -0,0 +1,18 @@
+// string literals share their characters, so changing a copy must not change the literal
+function word() { return "abc"; }
+var a = word();
+a += "d";
+var b = word();
+var all = "";
+for (var i=0;i<3;i++) {
+  var s = "x";
+  s += i;
+  all += s;
+}
+var o = { k : "lit" };
+o.k += "!";
+var shifted = (2<<2);
+var two = 2;
+
+result = a=="abcd" && b=="abc" && word()=="abc" && all=="x0x1x2" && o.k=="lit!" && "lit"+""=="lit" &&
+         shifted==8 && two==2;
@@ -0,0 +1,22 @@
+// true, false, null, undefined and small ints are shared constants, so using them must never change them
+var x = 2;
+var y = x<<1;
+var t = true;
+t++;
+var o = { flag : true, nothing : null };
+o.flag += 1;
+function g(p) { p.q = 1; return p.q; }
+var fromG = g(null);
+var arr = [1,2];
+arr[4] = 5;
+var count = 0;
+for (var i=0;i<10;i++) { var e = i==3; if (e) count++; count += 1; }
+var v = 1;
+v += 1;
+// ints outside the constants keep all their bits
+var wide = 5000000000;
+var wider = 123456789012;
+
+result = x==2 && y==4 && t==2 && true==1 && o.flag==2 && o.nothing==null && fromG==1 &&
+         arr.join(",")=="1,2,null,null,5" && count==11 && v==2 && 1+1==2 && false==0 &&
+         wide-4999999999==1 && wider-123456789000==12;
@@ -0,0 +1,31 @@
+// function calls keep their arguments and result in a call frame, and natives get their arguments by position
+function fact(n) { if (n<=1) return 1; return n*fact(n-1); }
+function inner() { return 5; }
+function outer() { inner(); }
+function firstOver(limit) { for (var i=0;i<100;i++) if (i*i>limit) return i; return -1; }
+function one() { return 1; }
+function nothing() { }
+function same(o) { return o; }
+function method() { return this.value; }
+function viaEval() { return eval("g*2"); }
+function viaExec() { exec("h = 7;"); return h+1; }
+var g = 21;
+var h = 0;
+var s = "hello";
+var obj = { value : 3, get : method };
+var two = one();
+two++;
+var arr = [1,2,3];
+var csv = "a,b,c";
+var parts = csv.split(",");
+
+// results that are shared constants are copied before a member is added to them
+var fx = nothing().x;
+var gy = one().y;
+var absz = Math.abs("s").z;
+
+result = fact(5)==120 && outer()==undefined && fx==undefined && gy==undefined && absz==undefined && inner()==5 && firstOver(50)==8 && one()==1 && two==2 &&
+         same(obj)==obj && obj.get()==3 && viaEval()==42 && viaExec()==8 && h==7 &&
+         s.charAt(1)=="e" && s.substring(1,3)=="el" && s.indexOf("l")==2 &&
+         Math.range(5,1,3)==3 && Math.range(0,1,3)==1 && Math.min(4,2)==2 && Math.abs(-3)==3 &&
+         arr.contains(2) && !arr.contains(4) && parts.length==3 && parts[2]=="c" && Integer.parseInt("12")==12;